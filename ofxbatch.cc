@@ -0,0 +1,126 @@
+#include <cstring>
+
+#include "ofxbatch.h"
+#include "ofxuid.h"
+
+namespace ofxget {
+
+VarsTable::VarsTable(const vector<string>& column_names) {
+  for (const string& name : column_names) {
+    columns_.push_back(Column{name, "", {}});
+  }
+}
+
+int VarsTable::FindColumn(std::string_view name) const {
+  for (std::size_t c = 0; c < columns_.size(); c++) {
+    if (columns_[c].name == name) return c;
+  }
+  return -1;
+}
+
+void VarsTable::Reserve(std::size_t rows, std::size_t value_size) {
+  for (Column& column : columns_) {
+    column.data.reserve(rows * value_size);
+    column.ends.reserve(rows);
+  }
+}
+
+void VarsTable::AddRow(const vector<std::string_view>& values) {
+  if (values.size() != columns_.size()) {
+    throw "Expected " + std::to_string(columns_.size()) + " values, got " +
+        std::to_string(values.size());
+  }
+  for (std::size_t c = 0; c < columns_.size(); c++) {
+    columns_[c].data.append(values[c]);
+    columns_[c].ends.push_back(columns_[c].data.size());
+  }
+  rows_++;
+}
+
+BatchRenderer::BatchRenderer(const RequestTemplate& request_template,
+                             const VarsTable& table, const VarsMap& shared)
+    : table_(table) {
+  std::size_t begin = 0;
+  for (const TemplateSegment& segment : request_template) {
+    std::string_view text = request_template.segment_text(segment);
+    if (!segment.is_var) {
+      fixed_.append(text);
+      continue;
+    }
+    int column = table.FindColumn(text);
+    if (column < 0 &&
+        (segment.var == kTrnUidVar || segment.var == kNewFileUidVar)) {
+      column = kNewUid;
+    }
+    if (column != kNoValue) {
+      pieces_.push_back(Piece{(uint32_t) begin,
+                              (uint32_t) (fixed_.size() - begin), column});
+      begin = fixed_.size();
+      continue;
+    }
+    const string* value = request_template.value(shared, segment);
+    if (!value) {
+      throw "Unspecified variable: " + string(text);
+    }
+    fixed_.append(*value);
+  }
+  pieces_.push_back(
+      Piece{(uint32_t) begin, (uint32_t) (fixed_.size() - begin), kNoValue});
+}
+
+std::size_t BatchRenderer::RenderedSize(std::size_t row) const {
+  std::size_t size = fixed_.size();
+  for (const Piece& piece : pieces_) {
+    if (piece.column >= 0) {
+      size += table_.value(row, piece.column).size();
+    } else if (piece.column == kNewUid) {
+      size += OFX_UID_SIZE;
+    }
+  }
+  return size;
+}
+
+char* BatchRenderer::RenderTo(std::size_t row, char* out) const {
+  for (const Piece& piece : pieces_) {
+    memcpy(out, fixed_.data() + piece.offset, piece.size);
+    out += piece.size;
+    if (piece.column >= 0) {
+      std::string_view value = table_.value(row, piece.column);
+      memcpy(out, value.data(), value.size());
+      out += value.size();
+    } else if (piece.column == kNewUid) {
+      WriteOfxUid(out);
+      out += OFX_UID_SIZE;
+    }
+  }
+  return out;
+}
+
+std::string_view BatchRenderer::Render(std::size_t row) {
+  std::size_t size = RenderedSize(row);
+  if (buffer_.size() < size) {
+    buffer_.resize(size);
+  }
+  RenderTo(row, &buffer_[0]);
+  return std::string_view(buffer_.data(), size);
+}
+
+void BatchRenderer::RenderAll(vector<std::string_view>* requests) {
+  std::size_t size = 0;
+  for (std::size_t row = 0; row < table_.rows(); row++) {
+    size += RenderedSize(row);
+  }
+  if (buffer_.size() < size) {
+    buffer_.resize(size);
+  }
+  requests->clear();
+  requests->reserve(table_.rows());
+  char* out = &buffer_[0];
+  for (std::size_t row = 0; row < table_.rows(); row++) {
+    char* end = RenderTo(row, out);
+    requests->emplace_back(out, end - out);
+    out = end;
+  }
+}
+
+}  // namespace ofxget
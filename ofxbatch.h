@@ -0,0 +1,111 @@
+#ifndef OFXBATCH_H
+#define OFXBATCH_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ofxtemplate.h"
+
+namespace ofxget {
+
+// Batch rendering renders one RequestTemplate for many accounts, eg a nightly
+// investment.txt run over every account, without a OfxGetContext, VarsMap or
+// template copy per account.
+//
+//   VarsTable accounts({"USERID", "USERPASS", "ACCTID"});
+//   accounts.AddRow({"user", "password", "0123456789"});
+//   ...
+//   BatchRenderer renderer(BuiltinRequestTemplate("investment.txt"),
+//                          accounts, shared_vars);
+//   for (std::size_t row = 0; row < accounts.rows(); row++) {
+//     std::string_view request = renderer.Render(row);
+//     ...
+//   }
+
+// Per account variables stored by column. Each column keeps the values of all
+// rows back to back in one buffer.
+class VarsTable {
+ public:
+  explicit VarsTable(const vector<string>& column_names);
+
+  std::size_t rows() const { return rows_; }
+  std::size_t columns() const { return columns_.size(); }
+  const string& column_name(std::size_t column) const {
+    return columns_[column].name;
+  }
+
+  // Index of the column named name, or -1.
+  int FindColumn(std::string_view name) const;
+
+  // Preallocate for rows rows of about value_size bytes per value.
+  void Reserve(std::size_t rows, std::size_t value_size);
+
+  // Append a row with one value per column, in column order. Throws a string
+  // if the number of values is wrong.
+  void AddRow(const vector<std::string_view>& values);
+
+  std::string_view value(std::size_t row, std::size_t column) const {
+    const Column& c = columns_[column];
+    uint32_t begin = row ? c.ends[row - 1] : 0;
+    return std::string_view(c.data.data() + begin, c.ends[row] - begin);
+  }
+
+ private:
+  struct Column {
+    string name;
+    string data;
+    // End offset of each row's value in data.
+    vector<uint32_t> ends;
+  };
+  vector<Column> columns_;
+  std::size_t rows_ = 0;
+};
+
+// Renders a template for rows of a VarsTable. Each variable is taken from the
+// table column of the same name, or else from shared vars that are the same
+// for every account (APPID, ORG, ...). Shared values are substituted once in
+// the constructor, so rendering a row only copies the fixed text between
+// table values. TRNUID and NEWFILEUID are not shared: unless the table has
+// them, every rendered request gets fresh UIDs.
+class BatchRenderer {
+ public:
+  // Throws a string naming the first variable found in neither table nor
+  // shared. table must outlive the renderer.
+  BatchRenderer(const RequestTemplate& request_template,
+                const VarsTable& table, const VarsMap& shared);
+
+  // Render row into a buffer reused by every call. The returned view is valid
+  // until the next Render or RenderAll. Allocates only when the request is
+  // larger than any rendered before.
+  std::string_view Render(std::size_t row);
+
+  // Render every row back to back into the buffer, sized exactly once, and
+  // set requests to a view of each. The views are valid until the next Render
+  // or RenderAll.
+  void RenderAll(vector<std::string_view>* requests);
+
+ private:
+  // Size of the request for row.
+  std::size_t RenderedSize(std::size_t row) const;
+  // Write the request for row to out, which has room for RenderedSize(row).
+  char* RenderTo(std::size_t row, char* out) const;
+
+  // fixed_[offset, offset + size) followed by the table value in column, no
+  // value if column is kNoValue or a new UID if it is kNewUid.
+  enum { kNoValue = -1, kNewUid = -2 };
+  struct Piece {
+    uint32_t offset;
+    uint32_t size;
+    int32_t column;
+  };
+  const VarsTable& table_;
+  string fixed_;
+  vector<Piece> pieces_;
+  string buffer_;
+};
+
+}  // namespace ofxget
+
+#endif // OFXBATCH_H
@@ -0,0 +1,210 @@
+#include "ofxbuilder.h"
+
+namespace ofxget {
+
+OfxRequestBuilder::OfxRequestBuilder(OfxDialect dialect, std::string* out)
+    : dialect_(dialect), out_(out) {
+  out_->clear();
+  out_->reserve(OFX_REQUEST_RESERVE);
+}
+
+OfxRequestBuilder& OfxRequestBuilder::Begin(std::string_view newfileuid) {
+  if (newfileuid.empty()) newfileuid = "NONE";
+  if (dialect_ == kOfxSgml102) {
+    Append("OFXHEADER:100\r\n"
+           "DATA:OFXSGML\r\n"
+           "VERSION:102\r\n"
+           "SECURITY:NONE\r\n"
+           "ENCODING:USASCII\r\n"
+           "CHARSET:1252\r\n"
+           "COMPRESSION:NONE\r\n"
+           "OLDFILEUID:NONE\r\n"
+           "NEWFILEUID:");
+    AppendEscaped(newfileuid);
+    Append("\r\n\r\n");
+  } else {
+    Append("<?xml version=\"1.0\" encoding=\"UTF-8\" "
+           "standalone=\"no\"?>\r\n"
+           "<?OFX OFXHEADER=\"200\" VERSION=\"203\" SECURITY=\"NONE\" "
+           "OLDFILEUID=\"NONE\" NEWFILEUID=\"");
+    AppendEscaped(newfileuid);
+    Append("\"?>\r\n\r\n");
+  }
+  Open("OFX");
+  return *this;
+}
+
+OfxRequestBuilder& OfxRequestBuilder::Signon(const OfxSignon& signon) {
+  MessageSet("SIGNONMSGSRQV1");
+  Open("SONRQ");
+  Element("DTCLIENT", signon.dtclient);
+  Element("USERID", signon.userid);
+  Element("USERPASS", signon.userpass);
+  Element("LANGUAGE", signon.language);
+  Open("FI");
+  Element("ORG", signon.org);
+  Element("FID", signon.fid, true);
+  Close("FI");
+  Element("APPID", signon.appid);
+  Element("APPVER", signon.appver);
+  Close("SONRQ");
+  return *this;
+}
+
+OfxRequestBuilder& OfxRequestBuilder::BankStatement(
+    std::string_view trnuid, const OfxAccount& account,
+    std::string_view dtstart) {
+  MessageSet("BANKMSGSRQV1");
+  Transaction("STMTTRNRQ", trnuid);
+  Open("STMTRQ");
+  Open("BANKACCTFROM");
+  Element("BANKID", account.bankid);
+  Element("ACCTID", account.acctid);
+  Element("ACCTTYPE", account.accttype);
+  Close("BANKACCTFROM");
+  Open("INCTRAN");
+  Element("DTSTART", dtstart, true);
+  Element("INCLUDE", "Y");
+  Close("INCTRAN");
+  Close("STMTRQ");
+  Close("STMTTRNRQ");
+  return *this;
+}
+
+OfxRequestBuilder& OfxRequestBuilder::CreditCardStatement(
+    std::string_view trnuid, const OfxAccount& account,
+    std::string_view dtstart) {
+  MessageSet("CREDITCARDMSGSRQV1");
+  Transaction("CCSTMTTRNRQ", trnuid);
+  Open("CCSTMTRQ");
+  Open("CCACCTFROM");
+  Element("ACCTID", account.acctid);
+  Close("CCACCTFROM");
+  Open("INCTRAN");
+  Element("DTSTART", dtstart, true);
+  Element("INCLUDE", "Y");
+  Close("INCTRAN");
+  Close("CCSTMTRQ");
+  Close("CCSTMTTRNRQ");
+  return *this;
+}
+
+OfxRequestBuilder& OfxRequestBuilder::InvestmentStatement(
+    std::string_view trnuid, const OfxAccount& account,
+    std::string_view dtstart, std::string_view dtasof) {
+  MessageSet("INVSTMTMSGSRQV1");
+  Transaction("INVSTMTTRNRQ", trnuid);
+  Open("INVSTMTRQ");
+  Open("INVACCTFROM");
+  Element("BROKERID", account.brokerid);
+  Element("ACCTID", account.acctid);
+  Close("INVACCTFROM");
+  Open("INCTRAN");
+  Element("DTSTART", dtstart, true);
+  Element("INCLUDE", "Y");
+  Close("INCTRAN");
+  Element("INCOO", "Y");
+  Open("INCPOS");
+  Element("DTASOF", dtasof, true);
+  Element("INCLUDE", "Y");
+  Close("INCPOS");
+  Element("INCBAL", "Y");
+  Close("INVSTMTRQ");
+  Close("INVSTMTTRNRQ");
+  return *this;
+}
+
+OfxRequestBuilder& OfxRequestBuilder::AccountInfo(std::string_view trnuid,
+                                                  std::string_view dtacctup) {
+  MessageSet("SIGNUPMSGSRQV1");
+  Transaction("ACCTINFOTRNRQ", trnuid);
+  Open("ACCTINFORQ");
+  Element("DTACCTUP", dtacctup);
+  Close("ACCTINFORQ");
+  Close("ACCTINFOTRNRQ");
+  return *this;
+}
+
+OfxRequestBuilder& OfxRequestBuilder::Profile(std::string_view trnuid,
+                                              std::string_view dtprofup) {
+  MessageSet("PROFMSGSRQV1");
+  Transaction("PROFTRNRQ", trnuid);
+  Open("PROFRQ");
+  Element("CLIENTROUTING", "NONE");
+  Element("DTPROFUP", dtprofup);
+  Close("PROFRQ");
+  Close("PROFTRNRQ");
+  return *this;
+}
+
+void OfxRequestBuilder::End() {
+  if (!msgset_.empty()) Close(msgset_);
+  msgset_ = std::string_view();
+  Close("OFX");
+}
+
+void OfxRequestBuilder::MessageSet(std::string_view msgset) {
+  if (msgset_ == msgset) return;
+  if (!msgset_.empty()) Close(msgset_);
+  msgset_ = msgset;
+  Open(msgset);
+}
+
+void OfxRequestBuilder::Transaction(std::string_view tag,
+                                    std::string_view trnuid) {
+  Open(tag);
+  Element("TRNUID", trnuid);
+  Element("CLTCOOKIE", cookie_, true);
+}
+
+void OfxRequestBuilder::Open(std::string_view tag) {
+  Append('<');
+  Append(tag);
+  Append(">\r\n");
+}
+
+void OfxRequestBuilder::Close(std::string_view tag) {
+  Append("</");
+  Append(tag);
+  Append(">\r\n");
+}
+
+void OfxRequestBuilder::Element(std::string_view tag, std::string_view value,
+                                bool optional) {
+  if (optional && value.empty()) return;
+  Append('<');
+  Append(tag);
+  Append('>');
+  AppendEscaped(value);
+  // SGML leaves elements open; XML closes them on the same line.
+  if (dialect_ == kOfxXml203) {
+    Append("</");
+    Append(tag);
+    Append('>');
+  }
+  Append("\r\n");
+}
+
+void OfxRequestBuilder::AppendEscaped(std::string_view value) {
+  // OFX 1.0.2 only defines &lt;, &gt; and &amp;. XML also needs quotes
+  // escaped in the header's attributes.
+  bool xml = dialect_ == kOfxXml203;
+  std::size_t begin = 0;
+  for (std::size_t i = 0; i < value.size(); i++) {
+    const char* entity;
+    switch (value[i]) {
+      case '<': entity = "&lt;"; break;
+      case '>': entity = "&gt;"; break;
+      case '&': entity = "&amp;"; break;
+      case '"': entity = xml ? "&quot;" : nullptr; break;
+      default: entity = nullptr; break;
+    }
+    if (!entity) continue;
+    Append(value.substr(begin, i - begin));
+    Append(entity);
+    begin = i + 1;
+  }
+  Append(value.substr(begin));
+}
+
+}  // namespace ofxget
@@ -0,0 +1,113 @@
+#ifndef OFXBUILDER_H
+#define OFXBUILDER_H
+
+#include <string>
+#include <string_view>
+
+namespace ofxget {
+
+// OfxRequestBuilder writes OFX requests without a template file, in the OFX
+// 1.0.2 SGML or 2.0.3 XML dialect, into one output string.
+// Values are escaped. Transactions are grouped into their message set
+// aggregates (BANKMSGSRQV1, ...) as they are added.
+//
+//   string request;
+//   OfxRequestBuilder(kOfxSgml102, &request)
+//       .Begin(NewOfxUid())
+//       .Signon(signon)
+//       .InvestmentStatement(NewOfxUid(), account, "19000101", date)
+//       .End();
+
+enum OfxDialect { kOfxSgml102, kOfxXml203 };
+
+// Bytes reserved in the output up front, enough for the requests above.
+#define OFX_REQUEST_RESERVE 2048
+
+struct OfxSignon {
+  std::string_view dtclient;
+  std::string_view userid;
+  std::string_view userpass;
+  std::string_view org;
+  std::string_view fid;
+  std::string_view appid;
+  std::string_view appver;
+  std::string_view language = "ENG";
+};
+
+// The account of a statement request. Bank accounts use bankid and accttype
+// (CHECKING, SAVINGS, ...), investment accounts use brokerid and credit cards
+// only acctid.
+struct OfxAccount {
+  std::string_view acctid;
+  std::string_view bankid;
+  std::string_view accttype;
+  std::string_view brokerid;
+};
+
+class OfxRequestBuilder {
+ public:
+  // Clear out and write the request to it.
+  OfxRequestBuilder(OfxDialect dialect, std::string* out);
+
+  // Write the headers and open <OFX>. An empty newfileuid is sent as NONE.
+  OfxRequestBuilder& Begin(std::string_view newfileuid);
+
+  OfxRequestBuilder& Signon(const OfxSignon& signon);
+
+  // Send <CLTCOOKIE> with the transactions added after this, unless empty.
+  OfxRequestBuilder& ClientCookie(std::string_view cookie) {
+    cookie_ = cookie;
+    return *this;
+  }
+
+  // Statement requests. Transactions since dtstart are included, all of them
+  // if dtstart is empty. Investment positions are as of dtasof, or the
+  // latest the server has if it is empty.
+  OfxRequestBuilder& BankStatement(std::string_view trnuid,
+                                   const OfxAccount& account,
+                                   std::string_view dtstart);
+  OfxRequestBuilder& CreditCardStatement(std::string_view trnuid,
+                                         const OfxAccount& account,
+                                         std::string_view dtstart);
+  OfxRequestBuilder& InvestmentStatement(std::string_view trnuid,
+                                         const OfxAccount& account,
+                                         std::string_view dtstart,
+                                         std::string_view dtasof);
+
+  // List the user's accounts changed since dtacctup, eg "19700101" for all.
+  OfxRequestBuilder& AccountInfo(std::string_view trnuid,
+                                 std::string_view dtacctup);
+
+  // The FI profile, if changed since dtprofup.
+  OfxRequestBuilder& Profile(std::string_view trnuid,
+                             std::string_view dtprofup);
+
+  // Close the open message set and </OFX>.
+  void End();
+
+ private:
+  // Open the message set aggregate msgset, closing any other one.
+  void MessageSet(std::string_view msgset);
+  // Open a transaction aggregate such as STMTTRNRQ with its TRNUID.
+  void Transaction(std::string_view tag, std::string_view trnuid);
+
+  void Open(std::string_view tag);
+  void Close(std::string_view tag);
+  // An element with a value, skipped if value is empty and optional.
+  void Element(std::string_view tag, std::string_view value,
+               bool optional = false);
+  void AppendEscaped(std::string_view value);
+
+  void Append(std::string_view text) { out_->append(text); }
+  void Append(char c) { out_->push_back(c); }
+
+  OfxDialect dialect_;
+  std::string* out_;
+  std::string_view cookie_;
+  // The open message set aggregate, or empty.
+  std::string_view msgset_;
+};
+
+}  // namespace ofxget
+
+#endif // OFXBUILDER_H
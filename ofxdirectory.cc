@@ -0,0 +1,698 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pugixml/pugixml.hpp"
+
+#include "ofxdirectory.h"
+#include "ofxtime.h"
+
+using std::string;
+using std::vector;
+
+namespace ofxget {
+
+static inline char AsciiLower(char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// 32 bit FNV-1a, optionally folding ASCII case.
+static uint32_t HashBytes(std::string_view s, bool fold_case,
+                          uint32_t h = 2166136261u) {
+  for (char c : s) {
+    h ^= (unsigned char) (fold_case ? AsciiLower(c) : c);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// Builds the interned string table of a compiled directory.
+class StringInterner {
+ public:
+  StringInterner() { Intern(""); }
+
+  DirStringId Intern(const string& s) {
+    auto it = ids_.find(s);
+    if (it != ids_.end()) {
+      return it->second;
+    }
+    DirStringId id = strings_.size();
+    strings_.push_back(DirString{(uint32_t) pool_.size(), (uint32_t) s.size()});
+    pool_ += s;
+    ids_.emplace(s, id);
+    return id;
+  }
+
+  const vector<DirString>& strings() const { return strings_; }
+  const string& pool() const { return pool_; }
+
+ private:
+  std::unordered_map<string, DirStringId> ids_;
+  vector<DirString> strings_;
+  string pool_;
+};
+
+string CompileInstitutions(const vector<Institution>& institutions) {
+  vector<const Institution*> sorted;
+  for (const Institution& i : institutions) {
+    sorted.push_back(&i);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const Institution* a, const Institution* b) {
+              return a->ofxhome_id < b->ofxhome_id;
+            });
+
+  StringInterner strings;
+  vector<DirRecord> records;
+  vector<DirProfileEntry> profile;
+  for (std::size_t i = 0; i < sorted.size(); i++) {
+    const Institution& inst = *sorted[i];
+    if (i > 0 && sorted[i - 1]->ofxhome_id == inst.ofxhome_id) {
+      throw "Duplicate institution id " + std::to_string(inst.ofxhome_id);
+    }
+    DirRecord r;
+    r.ofxhome_id = inst.ofxhome_id;
+    r.ofxfail = inst.ofxfail;
+    r.sslfail = inst.sslfail;
+    r.profile_begin = profile.size();
+    r.profile_count = inst.profile.size();
+    r.name = strings.Intern(inst.name);
+    r.fid = strings.Intern(inst.fid);
+    r.org = strings.Intern(inst.org);
+    r.url = strings.Intern(inst.url);
+    r.brokerid = strings.Intern(inst.brokerid);
+    r.bankid = strings.Intern(inst.bankid);
+    r.lastofxvalidation = strings.Intern(inst.lastofxvalidation);
+    r.lastsslvalidation = strings.Intern(inst.lastsslvalidation);
+    // std::map iterates in key order, which InstitutionView::profile relies
+    // on for its binary search.
+    for (const auto& p : inst.profile) {
+      profile.push_back(
+          DirProfileEntry{strings.Intern(p.first), strings.Intern(p.second)});
+    }
+    records.push_back(r);
+  }
+
+  DirHeader header;
+  // Zero the padding too, so the same institutions compile to the same bytes.
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INSTITUTIONS_DIR_MAGIC, sizeof(header.magic));
+  header.version = INSTITUTIONS_DIR_VERSION;
+  header.record_count = records.size();
+  header.profile_count = profile.size();
+  header.string_count = strings.strings().size();
+  header.pool_size = strings.pool().size();
+
+  string image;
+  image.reserve(sizeof(header) + records.size() * sizeof(DirRecord) +
+                profile.size() * sizeof(DirProfileEntry) +
+                strings.strings().size() * sizeof(DirString) +
+                strings.pool().size());
+  image.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  image.append(reinterpret_cast<const char*>(records.data()),
+               records.size() * sizeof(DirRecord));
+  image.append(reinterpret_cast<const char*>(profile.data()),
+               profile.size() * sizeof(DirProfileEntry));
+  image.append(reinterpret_cast<const char*>(strings.strings().data()),
+               strings.strings().size() * sizeof(DirString));
+  image += strings.pool();
+  return image;
+}
+
+static string ReadFile(const string& filename) {
+  std::ifstream f(filename, std::ios::binary);
+  if (!f.is_open()) {
+    throw "Could not open " + filename;
+  }
+  std::stringstream contents;
+  contents << f.rdbuf();
+  return contents.str();
+}
+
+void ApplyInstitutionOverrides(const string& overrides,
+                               vector<Institution>* institutions) {
+  pugi::xml_document doc;
+  if (!doc.load_string(overrides.c_str())) {
+    throw string("Could not parse institution overrides");
+  }
+  map<int, std::size_t> index;
+  for (std::size_t i = 0; i < institutions->size(); i++) {
+    index[(*institutions)[i].ofxhome_id] = i;
+  }
+  for (pugi::xml_node node = doc.child("institution"); node;
+       node = node.next_sibling("institution")) {
+    int id = node.attribute("id").as_int();
+    auto it = index.find(id);
+    if (it == index.end()) {
+      Institution added;
+      added.ofxhome_id = id;
+      added.ofxfail = 0;
+      added.sslfail = 0;
+      it = index.emplace(id, institutions->size()).first;
+      institutions->push_back(added);
+    }
+    Institution& inst = (*institutions)[it->second];
+    const std::pair<const char*, string*> fields[] = {
+      {"name", &inst.name}, {"fid", &inst.fid}, {"org", &inst.org},
+      {"url", &inst.url}, {"brokerid", &inst.brokerid},
+      {"bankid", &inst.bankid},
+      {"lastofxvalidation", &inst.lastofxvalidation},
+      {"lastsslvalidation", &inst.lastsslvalidation}};
+    for (const auto& field : fields) {
+      pugi::xml_node value = node.child(field.first);
+      if (value) {
+        *field.second = value.child_value();
+      }
+    }
+    if (node.child("ofxfail")) {
+      inst.ofxfail = node.child("ofxfail").text().as_int();
+    }
+    if (node.child("sslfail")) {
+      inst.sslfail = node.child("sslfail").text().as_int();
+    }
+    for (pugi::xml_attribute a : node.child("profile").attributes()) {
+      inst.profile[a.name()] = a.value();
+    }
+  }
+}
+
+static DirSource StatSource(const string& filename);
+
+string CompileInstitutionFiles(const string& institutions_file,
+                               const string& overrides_file) {
+  // Stat before reading, so a file changed while it is read is stale.
+  DirSource sources[] = {StatSource(institutions_file),
+                         StatSource(overrides_file)};
+  vector<Institution> institutions =
+      OfxDumpStringToInstitutions(ReadFile(institutions_file));
+  if (access(overrides_file.c_str(), R_OK) == 0) {
+    ApplyInstitutionOverrides(ReadFile(overrides_file), &institutions);
+  }
+  string image = CompileInstitutions(institutions);
+  memcpy(&image[offsetof(DirHeader, institutions_file)], &sources[0],
+         sizeof(DirSource));
+  memcpy(&image[offsetof(DirHeader, overrides_file)], &sources[1],
+         sizeof(DirSource));
+  return image;
+}
+
+void WriteCompiledInstitutions(const string& image, const string& filename) {
+  // A unique temporary file next to filename, so processes compiling at the
+  // same time, eg ofxget runs loading a changed institutions.txt, never write
+  // to the same file.
+  string tmp = filename + ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) {
+    throw "Could not create " + tmp;
+  }
+  // mkstemp creates the file readable only by its owner.
+  bool ok = fchmod(fd, 0644) == 0;
+  std::size_t written = 0;
+  while (ok && written < image.size()) {
+    ssize_t n = write(fd, image.data() + written, image.size() - written);
+    if (n < 0 && errno == EINTR) continue;
+    ok = n > 0;
+    if (ok) written += n;
+  }
+  if (close(fd) != 0 || !ok) {
+    unlink(tmp.c_str());
+    throw "Could not write " + tmp;
+  }
+  if (rename(tmp.c_str(), filename.c_str()) != 0) {
+    unlink(tmp.c_str());
+    throw "Could not rename " + tmp + " to " + filename;
+  }
+}
+
+std::unique_ptr<DirectoryImage> DirectoryImage::MapFile(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    throw "Could not open " + string(filename);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw "Could not stat " + string(filename);
+  }
+  std::unique_ptr<DirectoryImage> image(new DirectoryImage());
+  image->mapped_size_ = st.st_size;
+  if (image->mapped_size_ > 0) {
+    image->mapped_ = mmap(nullptr, image->mapped_size_, PROT_READ, MAP_SHARED,
+                          fd, 0);
+  }
+  close(fd);
+  if (image->mapped_ == MAP_FAILED || image->mapped_ == nullptr) {
+    image->mapped_ = nullptr;
+    throw "Could not mmap " + string(filename);
+  }
+  image->Init(static_cast<const char*>(image->mapped_), image->mapped_size_,
+              filename);
+  return image;
+}
+
+std::unique_ptr<DirectoryImage> DirectoryImage::FromString(string data) {
+  std::unique_ptr<DirectoryImage> image(new DirectoryImage());
+  image->owned_ = std::move(data);
+  image->Init(image->owned_.data(), image->owned_.size(), "image");
+  return image;
+}
+
+void DirectoryImage::Init(const char* base, size_t size, const string& name) {
+  if (size < sizeof(DirHeader)) {
+    throw "Not a compiled institution directory: " + name;
+  }
+  header_ = reinterpret_cast<const DirHeader*>(base);
+  std::size_t records_size =
+      (std::size_t) header_->record_count * sizeof(DirRecord);
+  std::size_t profile_size =
+      (std::size_t) header_->profile_count * sizeof(DirProfileEntry);
+  std::size_t strings_size =
+      (std::size_t) header_->string_count * sizeof(DirString);
+  if (memcmp(header_->magic, INSTITUTIONS_DIR_MAGIC,
+             sizeof(header_->magic)) != 0 ||
+      header_->version != INSTITUTIONS_DIR_VERSION ||
+      sizeof(DirHeader) + records_size + profile_size + strings_size +
+              header_->pool_size != size) {
+    throw "Incompatible institution directory: " + name +
+          ". Rerun ofxhome -compile.";
+  }
+  const char* p = base + sizeof(DirHeader);
+  records_ = reinterpret_cast<const DirRecord*>(p);
+  p += records_size;
+  profile_ = reinterpret_cast<const DirProfileEntry*>(p);
+  p += profile_size;
+  strings_ = reinterpret_cast<const DirString*>(p);
+  p += strings_size;
+  pool_ = p;
+
+  // Lookups index the tables without checks, so a corrupt file must not get
+  // this far.
+  uint32_t string_count = header_->string_count;
+  bool valid = true;
+  for (uint32_t i = 0; i < string_count && valid; i++) {
+    valid = strings_[i].offset <= header_->pool_size &&
+            strings_[i].size <= header_->pool_size - strings_[i].offset;
+  }
+  for (uint32_t i = 0; i < header_->record_count && valid; i++) {
+    const DirRecord& r = records_[i];
+    const DirStringId ids[] = {r.name, r.fid, r.org, r.url, r.brokerid,
+                               r.bankid, r.lastofxvalidation,
+                               r.lastsslvalidation};
+    for (DirStringId id : ids) {
+      valid = valid && id < string_count;
+    }
+    valid = valid && r.profile_begin <= header_->profile_count &&
+            r.profile_count <= header_->profile_count - r.profile_begin;
+  }
+  for (uint32_t i = 0; i < header_->profile_count && valid; i++) {
+    valid = profile_[i].key < string_count &&
+            profile_[i].value < string_count;
+  }
+  if (!valid) {
+    throw "Incompatible institution directory: " + name +
+          ". Rerun ofxhome -compile.";
+  }
+}
+
+static DirSource StatSource(const string& filename) {
+  DirSource source;
+  memset(&source, 0, sizeof(source));
+  source.path_hash = HashBytes(filename, false);
+  struct stat st;
+  if (stat(filename.c_str(), &st) == 0) {
+    source.exists = 1;
+    source.size = st.st_size;
+    struct timespec mtime = StatMtime(st);
+    source.mtime_sec = mtime.tv_sec;
+    source.mtime_nsec = mtime.tv_nsec;
+  }
+  return source;
+}
+
+static bool SameSource(const DirSource& a, const DirSource& b) {
+  return a.path_hash == b.path_hash && a.exists == b.exists &&
+         a.size == b.size && a.mtime_sec == b.mtime_sec &&
+         a.mtime_nsec == b.mtime_nsec;
+}
+
+bool DirectoryImage::CompiledFrom(const string& institutions_file,
+                                  const string& overrides_file) const {
+  return header_->institutions_file.exists &&
+         SameSource(header_->institutions_file,
+                    StatSource(institutions_file)) &&
+         SameSource(header_->overrides_file, StatSource(overrides_file));
+}
+
+DirectoryImage::~DirectoryImage() {
+  if (mapped_) {
+    munmap(mapped_, mapped_size_);
+  }
+}
+
+const DirRecord* DirectoryImage::FindById(int id) const {
+  const DirRecord* end = records_ + header_->record_count;
+  const DirRecord* r = std::lower_bound(
+      records_, end, id,
+      [](const DirRecord& r, int id) { return r.ofxhome_id < id; });
+  if (r == end || r->ofxhome_id != id) {
+    return nullptr;
+  }
+  return r;
+}
+
+std::string_view InstitutionView::profile(std::string_view key) const {
+  const DirProfileEntry* begin = image_->profile(*record_);
+  const DirProfileEntry* end = begin + record_->profile_count;
+  const DirProfileEntry* e = std::lower_bound(
+      begin, end, key, [this](const DirProfileEntry& e, std::string_view key) {
+        return image_->str(e.key) < key;
+      });
+  if (e == end || image_->str(e->key) != key) {
+    return std::string_view();
+  }
+  return image_->str(e->value);
+}
+
+uint32_t DecodeMessageSets(const InstitutionView& inst) {
+  static const std::pair<const char*, MessageSet> kAttributes[] = {
+    {"signonmsgset", kSignonMsgSet},
+    {"bankmsgset", kBankMsgSet},
+    {"creditcardmsgset", kCreditCardMsgSet},
+    {"invstmtmsgset", kInvestmentMsgSet},
+    {"billpaymsgset", kBillPayMsgSet},
+    {"seclistmsgset", kSecListMsgSet},
+    {"emailmsgset", kEmailMsgSet},
+    {"interxfermsgset", kInterTransferMsgSet},
+  };
+  uint32_t mask = 0;
+  for (const auto& attribute : kAttributes) {
+    if (inst.profile(attribute.first) == "true") {
+      mask |= attribute.second;
+    }
+  }
+  return mask;
+}
+
+// The process wide snapshot. Only accessed through std::atomic_load and
+// std::atomic_store so readers never observe a partially published pointer.
+static std::shared_ptr<const InstitutionDirectory> g_directory;
+// Serializes the first load so concurrent first users parse only once.
+static std::mutex g_directory_load_mutex;
+
+static uint32_t HashOrgFid(std::string_view org, std::string_view fid) {
+  return HashBytes(fid, false, HashBytes(org, false) * 16777619u);
+}
+
+static bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) return false;
+  for (std::size_t i = 0; i < a.size(); i++) {
+    if (AsciiLower(a[i]) != AsciiLower(b[i])) return false;
+  }
+  return true;
+}
+
+InstitutionDirectory::InstitutionDirectory(
+    std::unique_ptr<DirectoryImage> image)
+    : image_(std::move(image)) {
+  const DirRecord* records = image_->records();
+  message_sets_.resize(size());
+  for (uint32_t i = 0; i < size(); i++) {
+    message_sets_[i] = DecodeMessageSets(view(records[i]));
+  }
+  id_index_.Build(
+      size(),
+      [records](uint32_t i, uint32_t* h) {
+        *h = records[i].ofxhome_id * 2654435761u;
+        return true;
+      },
+      [records](uint32_t a, uint32_t b) {
+        return records[a].ofxhome_id == records[b].ofxhome_id;
+      });
+  fid_index_.Build(
+      size(),
+      [this, records](uint32_t i, uint32_t* h) {
+        *h = HashBytes(str(records[i].fid), false);
+        return records[i].fid != 0;
+      },
+      [this, records](uint32_t a, uint32_t b) {
+        return str(records[a].fid) == str(records[b].fid);
+      });
+  org_fid_index_.Build(
+      size(),
+      [this, records](uint32_t i, uint32_t* h) {
+        *h = HashOrgFid(str(records[i].org), str(records[i].fid));
+        return records[i].org != 0 || records[i].fid != 0;
+      },
+      [this, records](uint32_t a, uint32_t b) {
+        return str(records[a].org) == str(records[b].org) &&
+               str(records[a].fid) == str(records[b].fid);
+      });
+  host_index_.Build(
+      size(),
+      [this, records](uint32_t i, uint32_t* h) {
+        std::string_view host = UrlHost(str(records[i].url));
+        *h = HashBytes(host, true);
+        return !host.empty();
+      },
+      [this, records](uint32_t a, uint32_t b) {
+        return EqualsIgnoreCase(UrlHost(str(records[a].url)),
+                                UrlHost(str(records[b].url)));
+      });
+}
+
+std::shared_ptr<const InstitutionDirectory> InstitutionDirectory::FromImage(
+    std::unique_ptr<DirectoryImage> image) {
+  return std::shared_ptr<const InstitutionDirectory>(
+      new InstitutionDirectory(std::move(image)));
+}
+
+std::shared_ptr<const InstitutionDirectory>
+InstitutionDirectory::FromInstitutions(
+    const vector<Institution>& institutions) {
+  return FromImage(
+      DirectoryImage::FromString(CompileInstitutions(institutions)));
+}
+
+std::shared_ptr<const InstitutionDirectory> InstitutionDirectory::Load() {
+  if (access(INSTITUTIONS_DIR_FILE, F_OK) == 0) {
+    if (access(INSTITUTIONS_FILE, F_OK) != 0) {
+      // Nothing to compile, eg only the directory was installed.
+      return FromImage(DirectoryImage::MapFile(INSTITUTIONS_DIR_FILE));
+    }
+    try {
+      std::unique_ptr<DirectoryImage> image =
+          DirectoryImage::MapFile(INSTITUTIONS_DIR_FILE);
+      if (image->CompiledFrom(INSTITUTIONS_FILE, INSTITUTIONS_OVERRIDES_FILE)) {
+        return FromImage(std::move(image));
+      }
+    } catch (const string&) {
+      // Eg compiled by an older version. It is compiled again below.
+    }
+  }
+
+  string image = CompileInstitutionFiles(INSTITUTIONS_FILE,
+                                         INSTITUTIONS_OVERRIDES_FILE);
+  try {
+    WriteCompiledInstitutions(image, INSTITUTIONS_DIR_FILE);
+  } catch (const string&) {
+    // Caching is best effort, eg the directory may be read only.
+  }
+  return FromImage(DirectoryImage::FromString(std::move(image)));
+}
+
+std::shared_ptr<const InstitutionDirectory> InstitutionDirectory::Get() {
+  std::shared_ptr<const InstitutionDirectory> dir =
+      std::atomic_load(&g_directory);
+  if (dir) {
+    return dir;
+  }
+  std::lock_guard<std::mutex> lock(g_directory_load_mutex);
+  dir = std::atomic_load(&g_directory);
+  if (!dir) {
+    dir = Load();
+    std::atomic_store(&g_directory, dir);
+  }
+  return dir;
+}
+
+void InstitutionDirectory::Set(std::shared_ptr<const InstitutionDirectory> dir) {
+  std::atomic_store(&g_directory, std::move(dir));
+}
+
+void InstitutionDirectory::Reload() {
+  Set(Load());
+}
+
+const DirRecord* InstitutionDirectory::FindById(int id) const {
+  const DirRecord* records = image_->records();
+  const DirRecord* found = nullptr;
+  id_index_.ForEach(
+      id * 2654435761u,
+      [records, id](uint32_t i) { return records[i].ofxhome_id == id; },
+      [records, &found](uint32_t i) {
+        found = &records[i];
+        return false;
+      });
+  return found;
+}
+
+const DirRecord* InstitutionDirectory::FindByFid(std::string_view fid) const {
+  const DirRecord* records = image_->records();
+  const DirRecord* found = nullptr;
+  fid_index_.ForEach(
+      HashBytes(fid, false),
+      [this, records, fid](uint32_t i) { return str(records[i].fid) == fid; },
+      [records, &found](uint32_t i) {
+        found = &records[i];
+        return false;
+      });
+  return found;
+}
+
+const DirRecord* InstitutionDirectory::FindByOrgFid(
+    std::string_view org, std::string_view fid) const {
+  const DirRecord* records = image_->records();
+  const DirRecord* found = nullptr;
+  org_fid_index_.ForEach(
+      HashOrgFid(org, fid),
+      [this, records, org, fid](uint32_t i) {
+        return str(records[i].org) == org && str(records[i].fid) == fid;
+      },
+      [records, &found](uint32_t i) {
+        found = &records[i];
+        return false;
+      });
+  return found;
+}
+
+const DirRecord* InstitutionDirectory::FindByHost(
+    std::string_view host) const {
+  const DirRecord* records = image_->records();
+  const DirRecord* found = nullptr;
+  host_index_.ForEach(
+      HashBytes(host, true),
+      [this, records, host](uint32_t i) {
+        return EqualsIgnoreCase(UrlHost(str(records[i].url)), host);
+      },
+      [records, &found](uint32_t i) {
+        found = &records[i];
+        return false;
+      });
+  return found;
+}
+
+void InstitutionDirectory::FindAllByFid(
+    std::string_view fid, vector<const DirRecord*>* out) const {
+  const DirRecord* records = image_->records();
+  fid_index_.ForEach(
+      HashBytes(fid, false),
+      [this, records, fid](uint32_t i) { return str(records[i].fid) == fid; },
+      [records, out](uint32_t i) {
+        out->push_back(&records[i]);
+        return true;
+      });
+}
+
+void InstitutionDirectory::FindAllByHost(
+    std::string_view host, vector<const DirRecord*>* out) const {
+  const DirRecord* records = image_->records();
+  host_index_.ForEach(
+      HashBytes(host, true),
+      [this, records, host](uint32_t i) {
+        return EqualsIgnoreCase(UrlHost(str(records[i].url)), host);
+      },
+      [records, out](uint32_t i) {
+        out->push_back(&records[i]);
+        return true;
+      });
+}
+
+void InstitutionDirectory::FindByMessageSets(
+    uint32_t mask, vector<const DirRecord*>* out) const {
+  const DirRecord* records = image_->records();
+  for (uint32_t i = 0; i < message_sets_.size(); i++) {
+    if ((message_sets_[i] & mask) == mask) {
+      out->push_back(&records[i]);
+    }
+  }
+}
+
+std::string_view InstitutionDirectory::UrlHost(std::string_view url) {
+  std::size_t begin = 0;
+  for (std::size_t i = 0; i + 2 < url.size() && url[i] != '/'; i++) {
+    if (url[i] == ':' && url[i + 1] == '/' && url[i + 2] == '/') {
+      begin = i + 3;
+      break;
+    }
+  }
+  std::size_t end = begin;
+  while (end < url.size() && url[end] != ':' && url[end] != '/' &&
+         url[end] != '?' && url[end] != '#') {
+    end++;
+  }
+  return url.substr(begin, end - begin);
+}
+
+const DirRecord* InstitutionDirectory::FindByName(std::string_view name) const {
+  const DirRecord* records = image_->records();
+  for (uint32_t i = 0; i < size(); i++) {
+    if (str(records[i].name).find(name) != std::string_view::npos) {
+      return &records[i];
+    }
+  }
+  return nullptr;
+}
+
+vector<InstitutionMatch> InstitutionDirectory::Search(std::string_view query,
+                                                      std::size_t k) const {
+  const DirRecord* records = image_->records();
+  std::call_once(name_index_once_, [this, records]() {
+    vector<std::string_view> names;
+    names.reserve(size());
+    for (uint32_t i = 0; i < size(); i++) {
+      names.push_back(str(records[i].name));
+    }
+    name_index_.Build(names);
+  });
+  vector<InstitutionMatch> matches;
+  for (const TrigramIndex::Match& m : name_index_.Search(query, k)) {
+    matches.push_back(InstitutionMatch{&records[m.doc], m.score});
+  }
+  return matches;
+}
+
+Institution InstitutionDirectory::ToInstitution(const DirRecord& r) const {
+  InstitutionView v = view(r);
+  Institution i;
+  i.ofxhome_id = v.ofxhome_id();
+  i.name = v.name();
+  i.fid = v.fid();
+  i.org = v.org();
+  i.url = v.url();
+  i.ofxfail = v.ofxfail();
+  i.sslfail = v.sslfail();
+  i.lastofxvalidation = v.lastofxvalidation();
+  i.lastsslvalidation = v.lastsslvalidation();
+  i.brokerid = v.brokerid();
+  i.bankid = v.bankid();
+  for (uint32_t p = 0; p < v.profile_size(); p++) {
+    i.profile[string(v.profile_key(p))] = v.profile_value(p);
+  }
+  return i;
+}
+
+}  // namespace ofxget
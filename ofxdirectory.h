@@ -0,0 +1,399 @@
+#ifndef OFXDIRECTORY_H
+#define OFXDIRECTORY_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ofxhome.h"
+#include "ofxsearch.h"
+
+namespace ofxget {
+
+// A compiled institution directory is a binary image of institutions.txt that
+// can be mmapped and searched without any parsing. It is produced by
+// "ofxhome -compile" and read through InstitutionDirectory.
+//
+// Layout, all integers in native byte order:
+//
+//   DirHeader
+//   DirRecord[record_count]         fixed width, sorted by ofxhome_id
+//   DirProfileEntry[profile_count]  profile attributes, grouped per record
+//                                   and sorted by key within a record
+//   DirString[string_count]         string table indexed by DirStringId
+//   char[pool_size]                 string bytes referenced by DirString
+//
+// Strings are interned: every distinct string, eg the ORG "DI" shared by 168
+// institutions or the "signonmsgset" profile key, is stored once and
+// referenced by id. Id 0 is always the empty string. Every field is 4 byte
+// aligned so records can be read in place.
+
+#define INSTITUTIONS_FILE "institutions.txt"
+#define INSTITUTIONS_OVERRIDES_FILE "institutions_overrides.txt"
+#define INSTITUTIONS_DIR_FILE "institutions.dir"
+#define INSTITUTIONS_DIR_MAGIC "OFXDIR\0\0"
+#define INSTITUTIONS_DIR_VERSION 3
+
+typedef uint32_t DirStringId;
+
+// Location of a string in the pool. Strings are not NUL terminated.
+struct DirString {
+  uint32_t offset;
+  uint32_t size;
+};
+
+// A file a directory was compiled from, as it was when it was read. All zero
+// for an image compiled from institutions in memory.
+struct DirSource {
+  // Hash of the name the file was read by.
+  uint32_t path_hash;
+  uint32_t exists;
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+};
+
+struct DirHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_count;
+  uint32_t profile_count;
+  uint32_t string_count;
+  uint32_t pool_size;
+  DirSource institutions_file;
+  DirSource overrides_file;
+};
+
+struct DirRecord {
+  int32_t ofxhome_id;
+  int32_t ofxfail;
+  int32_t sslfail;
+  uint32_t profile_begin;
+  uint32_t profile_count;
+  DirStringId name;
+  DirStringId fid;
+  DirStringId org;
+  DirStringId url;
+  DirStringId brokerid;
+  DirStringId bankid;
+  DirStringId lastofxvalidation;
+  DirStringId lastsslvalidation;
+};
+
+struct DirProfileEntry {
+  DirStringId key;
+  DirStringId value;
+};
+
+// Serialize institutions into a compiled directory image. Throws a string on
+// error.
+string CompileInstitutions(const vector<Institution>& institutions);
+
+// Apply local overrides to institutions. overrides uses the institutions.txt
+// format, but an override only needs the elements and profile attributes it
+// changes, eg
+//
+//   <institution id="479"><url>https://example.com/ofx</url></institution>
+//
+// Institutions with ids that are not in institutions are added. Throws a
+// string if overrides can not be parsed.
+void ApplyInstitutionOverrides(const string& overrides,
+                               vector<Institution>* institutions);
+
+// Read institutions_file, apply overrides_file if it exists and compile the
+// result. Both files are recorded in the header, see
+// DirectoryImage::CompiledFrom. Throws a string on error.
+string CompileInstitutionFiles(const string& institutions_file,
+                               const string& overrides_file);
+
+// Write a compiled directory image to filename. The file is replaced
+// atomically so processes that have the old file mapped are unaffected.
+// Throws a string on error.
+void WriteCompiledInstitutions(const string& image, const string& filename);
+
+// Read only view of a compiled directory image. The image is either mapped
+// from a file or owned in memory. Lookups do not allocate; records are found
+// with a binary search over the record table.
+class DirectoryImage {
+ public:
+  // Map filename. Throws a string if the file can not be mapped or is not a
+  // compiled directory of the current version.
+  static std::unique_ptr<DirectoryImage> MapFile(const char* filename);
+
+  // Take ownership of an image returned by CompileInstitutions.
+  static std::unique_ptr<DirectoryImage> FromString(string image);
+
+  ~DirectoryImage();
+
+  DirectoryImage(const DirectoryImage&) = delete;
+  DirectoryImage& operator=(const DirectoryImage&) = delete;
+
+  // Returns nullptr if there is no institution with the given id.
+  const DirRecord* FindById(int id) const;
+
+  std::string_view str(DirStringId id) const {
+    return std::string_view(pool_ + strings_[id].offset, strings_[id].size);
+  }
+
+  // Returns true if the image was compiled by CompileInstitutionFiles from
+  // files with these names, and neither has been modified, created or removed
+  // since.
+  bool CompiledFrom(const string& institutions_file,
+                    const string& overrides_file) const;
+
+  const DirRecord* records() const { return records_; }
+  uint32_t record_count() const { return header_->record_count; }
+  const DirProfileEntry* profile(const DirRecord& r) const {
+    return profile_ + r.profile_begin;
+  }
+
+ private:
+  DirectoryImage() : mapped_(nullptr), mapped_size_(0) {}
+  void Init(const char* data, size_t size, const string& name);
+
+  string owned_;
+  void* mapped_;
+  size_t mapped_size_;
+  const DirHeader* header_;
+  const DirRecord* records_;
+  const DirProfileEntry* profile_;
+  const DirString* strings_;
+  const char* pool_;
+};
+
+// string_view accessors for one record of a DirectoryImage. Views are cheap
+// to copy and valid as long as the image is.
+class InstitutionView {
+ public:
+  InstitutionView(const DirectoryImage& image, const DirRecord& record)
+      : image_(&image), record_(&record) {}
+
+  const DirRecord& record() const { return *record_; }
+  int ofxhome_id() const { return record_->ofxhome_id; }
+  int ofxfail() const { return record_->ofxfail; }
+  int sslfail() const { return record_->sslfail; }
+  std::string_view name() const { return image_->str(record_->name); }
+  std::string_view fid() const { return image_->str(record_->fid); }
+  std::string_view org() const { return image_->str(record_->org); }
+  std::string_view url() const { return image_->str(record_->url); }
+  std::string_view brokerid() const { return image_->str(record_->brokerid); }
+  std::string_view bankid() const { return image_->str(record_->bankid); }
+  std::string_view lastofxvalidation() const {
+    return image_->str(record_->lastofxvalidation);
+  }
+  std::string_view lastsslvalidation() const {
+    return image_->str(record_->lastsslvalidation);
+  }
+
+  // Profile attributes in key order.
+  uint32_t profile_size() const { return record_->profile_count; }
+  std::string_view profile_key(uint32_t i) const {
+    return image_->str(image_->profile(*record_)[i].key);
+  }
+  std::string_view profile_value(uint32_t i) const {
+    return image_->str(image_->profile(*record_)[i].value);
+  }
+  // Value of the profile attribute key, or an empty string if unset.
+  std::string_view profile(std::string_view key) const;
+
+ private:
+  const DirectoryImage* image_;
+  const DirRecord* record_;
+};
+
+// Open addressing hash index from a key to directory records. Each slot holds
+// one distinct key; records sharing a key are chained in record order so
+// popular keys (eg a hosting provider's server) do not form probe clusters.
+// Only hashes and record numbers are stored. Keys are compared against the
+// records themselves so neither building nor probing copies strings.
+class RecordIndex {
+ public:
+  // Index records [0, count). hash(i, &h) returns false for records that
+  // have no key, otherwise sets h to the key hash of record i. same(a, b)
+  // returns true if records a and b have the same key.
+  template <typename HashFn, typename SameFn>
+  void Build(uint32_t count, HashFn hash, SameFn same);
+
+  // Call fn(i) for every record i with the key whose hash is h and for which
+  // eq(i) is true, in record order. Stops early when fn returns false.
+  template <typename EqFn, typename Fn>
+  void ForEach(uint32_t h, EqFn eq, Fn fn) const;
+
+ private:
+  static constexpr uint32_t kEmpty = 0xffffffff;
+  struct Slot {
+    uint32_t hash;
+    uint32_t head;
+    uint32_t tail;
+  };
+  vector<Slot> slots_;
+  vector<uint32_t> next_;
+  uint32_t mask_ = 0;
+};
+
+template <typename HashFn, typename SameFn>
+void RecordIndex::Build(uint32_t count, HashFn hash, SameFn same) {
+  uint32_t capacity = 16;
+  while (capacity < count * 2) {
+    capacity *= 2;
+  }
+  slots_.assign(capacity, Slot{0, kEmpty, kEmpty});
+  next_.assign(count, kEmpty);
+  mask_ = capacity - 1;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t h;
+    if (!hash(i, &h)) continue;
+    uint32_t pos = h & mask_;
+    while (slots_[pos].head != kEmpty &&
+           !(slots_[pos].hash == h && same(slots_[pos].head, i))) {
+      pos = (pos + 1) & mask_;
+    }
+    if (slots_[pos].head == kEmpty) {
+      slots_[pos] = Slot{h, i, i};
+    } else {
+      next_[slots_[pos].tail] = i;
+      slots_[pos].tail = i;
+    }
+  }
+}
+
+template <typename EqFn, typename Fn>
+void RecordIndex::ForEach(uint32_t h, EqFn eq, Fn fn) const {
+  if (slots_.empty()) return;
+  for (uint32_t pos = h & mask_; slots_[pos].head != kEmpty;
+       pos = (pos + 1) & mask_) {
+    if (slots_[pos].hash == h && eq(slots_[pos].head)) {
+      for (uint32_t i = slots_[pos].head; i != kEmpty; i = next_[i]) {
+        if (!fn(i)) return;
+      }
+      return;
+    }
+  }
+}
+
+// OFX message sets an institution's profile says it supports, decoded from
+// the *msgset="true" profile attributes into a bitmask.
+enum MessageSet : uint32_t {
+  kSignonMsgSet = 1 << 0,
+  kBankMsgSet = 1 << 1,
+  kCreditCardMsgSet = 1 << 2,
+  kInvestmentMsgSet = 1 << 3,
+  kBillPayMsgSet = 1 << 4,
+  kSecListMsgSet = 1 << 5,
+  kEmailMsgSet = 1 << 6,
+  kInterTransferMsgSet = 1 << 7,
+};
+
+// Decode the message set profile attributes of a record.
+uint32_t DecodeMessageSets(const InstitutionView& inst);
+
+struct InstitutionMatch {
+  const DirRecord* record;
+  // Similarity to the query in (0, 1].
+  float score;
+};
+
+// InstitutionDirectory is an immutable, thread safe snapshot of all
+// institutions. One snapshot is shared by every OfxGetContext in the process
+// and is loaded on first use:
+//
+//   std::shared_ptr<const InstitutionDirectory> dir =
+//       InstitutionDirectory::Get();
+//   const DirRecord* vanguard = dir->FindById(479);
+//
+// A refreshed directory can be published with Set or Reload at any time.
+// Readers keep using the snapshot they hold until they release it, so a swap
+// never blocks or invalidates a lookup in progress.
+class InstitutionDirectory {
+ public:
+  // Load the layered directory: institutions.txt with
+  // institutions_overrides.txt applied on top. The merged result is cached
+  // in institutions.dir, which is mapped instead of parsing while it was
+  // compiled from both files as they are now, or if there is no
+  // institutions.txt to compile. Throws a string on error.
+  static std::shared_ptr<const InstitutionDirectory> Load();
+
+  static std::shared_ptr<const InstitutionDirectory> FromImage(
+      std::unique_ptr<DirectoryImage> image);
+  static std::shared_ptr<const InstitutionDirectory> FromInstitutions(
+      const vector<Institution>& institutions);
+
+  // Return the process wide snapshot, loading it on first use. Throws a
+  // string if it can not be loaded.
+  static std::shared_ptr<const InstitutionDirectory> Get();
+
+  // Atomically replace the process wide snapshot.
+  static void Set(std::shared_ptr<const InstitutionDirectory> dir);
+
+  // Load the directory from disk again and publish it with Set.
+  static void Reload();
+
+  const DirectoryImage& image() const { return *image_; }
+  uint32_t size() const { return image_->record_count(); }
+  std::string_view str(DirStringId id) const { return image_->str(id); }
+  InstitutionView view(const DirRecord& r) const {
+    return InstitutionView(*image_, r);
+  }
+
+  // Returns nullptr if there is no institution with the given id.
+  const DirRecord* FindById(int id) const;
+
+  // Hash lookups by the keys found in bank feeds. Each returns the matching
+  // institution with the lowest id, or nullptr. Hosts are compared case
+  // insensitively.
+  const DirRecord* FindByFid(std::string_view fid) const;
+  const DirRecord* FindByOrgFid(std::string_view org,
+                                std::string_view fid) const;
+  const DirRecord* FindByHost(std::string_view host) const;
+
+  // Append every institution with the given key to out, in id order.
+  void FindAllByFid(std::string_view fid,
+                    vector<const DirRecord*>* out) const;
+  void FindAllByHost(std::string_view host,
+                     vector<const DirRecord*>* out) const;
+
+  // Returns the first institution whose name contains name, or nullptr.
+  const DirRecord* FindByName(std::string_view name) const;
+
+  // Bitmask of MessageSet values supported by r.
+  uint32_t message_sets(const DirRecord& r) const {
+    return message_sets_[&r - image_->records()];
+  }
+
+  // Append every institution supporting all of the message sets in mask to
+  // out, in id order. Only the bitmask column is scanned.
+  void FindByMessageSets(uint32_t mask, vector<const DirRecord*>* out) const;
+
+  // Return up to k institutions whose names best match query, best first.
+  // Matching ignores case and punctuation and tolerates small typos, eg
+  // "vangaurd" finds "Vanguard Group, The". The search index is built on the
+  // first call for each snapshot.
+  vector<InstitutionMatch> Search(std::string_view query, std::size_t k) const;
+
+  // Return the host part of an OFX server url, eg "ofx.lanxtra.com" for
+  // "https://ofx.lanxtra.com/ofx/servlet/Teller".
+  static std::string_view UrlHost(std::string_view url);
+
+  // Copy a record out of the directory.
+  Institution ToInstitution(const DirRecord& r) const;
+
+ private:
+  explicit InstitutionDirectory(std::unique_ptr<DirectoryImage> image);
+
+  std::unique_ptr<DirectoryImage> image_;
+  // MessageSet bitmask of each record, in record order.
+  vector<uint32_t> message_sets_;
+  RecordIndex id_index_;
+  RecordIndex fid_index_;
+  RecordIndex org_fid_index_;
+  RecordIndex host_index_;
+  mutable std::once_flag name_index_once_;
+  mutable TrigramIndex name_index_;
+};
+
+}  // namespace ofxget
+
+#endif // OFXDIRECTORY_H
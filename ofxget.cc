@@ -1,7 +1,6 @@
 #include <cstring>
 #include <iostream>
 #include <map>
-#include <fstream>
 #include <string>
 #include <vector>
 
@@ -9,8 +8,12 @@
 
 #include "pugixml/pugixml.hpp"
 
+#include "ofxdirectory.h"
 #include "ofxget.h"
 #include "ofxget_apps.h"
+#include "ofxhttp.h"
+#include "ofxtime.h"
+#include "ofxuid.h"
 
 namespace ofxget {
 
@@ -22,15 +25,28 @@ using std::string;
 using std::vector;
 
 // Forward declarations
-static size_t CurlWriteToString(char *ptr, size_t size, size_t nmemb, void *userdata);
-size_t HeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata);
+static size_t CurlWriteToSink(char *ptr, size_t size, size_t nmemb, void *userdata);
+static size_t CurlReadTemplate(char *buffer, size_t size, size_t nitems, void *userdata);
+static int CurlSeekTemplate(void *userdata, curl_off_t offset, int origin);
 
 OfxGetContext::OfxGetContext() {
   Reset();
 }
 
+OfxGetContext::~OfxGetContext() {
+  curl_slist_free_all(request_headers_);
+  RecycleResponse();
+}
+
+void OfxGetContext::RecycleResponse() {
+  ResponseBufferPool::Global().Give(std::move(response_));
+  response_ = string();
+}
+
 void OfxGetContext::Reset() {
   InitVars(&vars_map_);
+  institution_id_ = -1;
+  min_health_ = 0;
 }
 
 OfxGetContext& OfxGetContext::AddApp(const string& name) {
@@ -38,8 +54,8 @@ OfxGetContext& OfxGetContext::AddApp(const string& name) {
   auto apps = OfxApps();
   for (std::size_t i = 0; i < apps.size(); i++) {
     if (apps[i].name == name) {
-      vars_map_["APPID"] = apps[i].appid;
-      vars_map_["APPVER"] = apps[i].appver;
+      vars_map_[kAppIdVar] = apps[i].appid;
+      vars_map_[kAppVerVar] = apps[i].appver;
       return *this;
     }
   }
@@ -49,32 +65,36 @@ OfxGetContext& OfxGetContext::AddApp(const string& name) {
 
 OfxGetContext& OfxGetContext::AddInstitution(int id) {
   if (is_error()) return *this;
-  std::string id_str = std::to_string(id);
-  string filename = "institutions.txt";
-  pugi::xml_document doc;
-  pugi::xml_parse_result result = doc.load_file(filename.c_str());
-  if (!result) {
-    error_string_ = "Could not parse " + filename;
-    return *this;
-  }
-  auto inst = doc.find_child_by_attribute("institution", "id", id_str.c_str());
-  if (inst.empty()) {
-    error_string_ = "Could not find institution " + id_str;
-    return *this;
-  }
-  std::vector<string> var_names {"org", "fid", "brokerid", "bankid", "url"};
-  for (string name : var_names) {
-    auto var = inst.child(name.c_str());
-    if (var) {
-      for (std::size_t i = 0; i < name.size(); i++) {
-        name[i] = toupper(name[i]);
+  try {
+    std::shared_ptr<const InstitutionDirectory> dir =
+        InstitutionDirectory::Get();
+    const DirRecord* r = dir->FindById(id);
+    if (!r) {
+      error_string_ = "Could not find institution " + std::to_string(id);
+      return *this;
+    }
+    institution_id_ = id;
+    InstitutionView inst = dir->view(*r);
+    const std::pair<OfxVar, std::string_view> fields[] = {
+      {kOrgVar, inst.org()}, {kFidVar, inst.fid()},
+      {kBrokerIdVar, inst.brokerid()}, {kBankIdVar, inst.bankid()},
+      {kUrlVar, inst.url()}};
+    for (const auto& field : fields) {
+      if (!field.second.empty()) {
+        vars_map_[field.first] = field.second;
       }
-      vars_map_[name] = var.child_value();
     }
+  } catch (const string& msg) {
+    error_string_ = msg;
   }
   return *this;
 }
 
+OfxGetContext& OfxGetContext::SkipUnhealthy(double min_score) {
+  min_health_ = min_score;
+  return *this;
+}
+
 OfxGetContext& OfxGetContext::AddPasswordsForTest(
     int id, const char* filename) {
   if (is_error()) return *this;
@@ -96,55 +116,58 @@ OfxGetContext& OfxGetContext::AddPasswordsForTest(
 
 string OfxGetContext::GetRequestTemplate(const string& filename) {
   if (is_error()) return "";
-  std::ifstream f(filename);
-  if (!f.is_open()) {
-    error_string_ = "Could not open " + filename;
+  try {
+    return string(TemplateCache::Global().Get(filename).text());
+  } catch (const string& msg) {
+    error_string_ = msg;
     return "";
   }
+}
 
-  string line;
-  string request_template;
-  while (std::getline(f, line)) {
-    request_template += line + "\r\n";
+OfxGetContext& OfxGetContext::AddRequestTemplateFile(const string& filename) {
+  if (is_error()) return *this;
+  try {
+    request_template_ = TemplateCache::Global().Get(filename);
+  } catch (const string& msg) {
+    error_string_ = msg;
   }
-
-  return request_template;
+  return *this;
 }
 
 OfxGetContext& OfxGetContext::AddRequestTemplate(
     const string& request_template) {
   if (is_error()) return *this;
+  request_template_ = RequestTemplate(request_template);
+  return *this;
+}
+
+OfxGetContext& OfxGetContext::AddRequestTemplate(
+    const RequestTemplate& request_template) {
+  if (is_error()) return *this;
   request_template_ = request_template;
   return *this;
 }
 
 string OfxGetContext::request() {
   if (is_error()) return "";
-  string subbed = request_template_;
-  for (std::size_t i = 0; i < subbed.size(); i++) {
-    if (subbed[i] == '$') {
-      std::size_t j;
-      for (j = i + 1; j < subbed.size(); j++) {
-        if (!isupper(subbed[j])) {
-          break;
-        }
-      }
-      string var = subbed.substr(i + 1, j - i - 1);
-      VarsMap::const_iterator it = vars_map_.find(var);
-      if (it != vars_map_.end()) {
-        subbed.replace(i, j - i, it->second);
-      } else {
-        error_string_ = "Unspecified variable: " + var;
-        return "";
-      }
-    }
+  string rendered;
+  string missing;
+  if (!request_template_.Render(vars_map_, &rendered, &missing)) {
+    error_string_ = "Unspecified variable: " + missing;
+    return "";
   }
-  return subbed;
+  return rendered;
 }
 
 OfxGetContext& OfxGetContext::PostRequest() {
+  CURL *curl = StartPost();
+  if (!curl) return *this;
+  return FinishPost(curl, curl_easy_perform(curl));
+}
+
+CURL* OfxGetContext::StartPost() {
   response_.clear();
-  if (is_error()) return *this;
+  if (is_error()) return nullptr;
     // Fake account
     if (0) { response_ = R"FAKE(OFXHEADER:100
                   DATA:OFXSGML
@@ -249,7 +272,7 @@ OfxGetContext& OfxGetContext::PostRequest() {
                   </ACCTINFORS>
                   </ACCTINFOTRNRS>
                   </SIGNUPMSGSRSV1>
-                  </OFX>)FAKE"; return *this; }
+                  </OFX>)FAKE"; return nullptr; }
     // Fake investment
     if (0) { response_ = R"FAKE(OFXHEADER:100
             DATA:OFXSGML
@@ -263,106 +286,180 @@ OfxGetContext& OfxGetContext::PostRequest() {
 
             <OFX><SIGNONMSGSRSV1><SONRS><STATUS><CODE>0<SEVERITY>INFO<MESSAGE>Successful Sign On</STATUS><DTSERVER>20180321202323[-5:EST]<LANGUAGE>ENG<DTPROFUP>20140605083000<FI><ORG>Vanguard<FID>15103</FI><SESSCOOKIE>xx</SONRS></SIGNONMSGSRSV1><INVSTMTMSGSRSV1><INVSTMTTRNRS><TRNUID>20180321182302.000<STATUS><CODE>0<SEVERITY>INFO</STATUS><CLTCOOKIE>4<INVSTMTRS><DTASOF>20180321160000.000[-5:EST]<CURDEF>USD<INVACCTFROM><BROKERID>vanguard.com<ACCTID>123</INVACCTFROM><INVTRANLIST><DTSTART>20160921160000.000[-5:EST]<DTEND>20180321202323.000[-5:EST]<BUYMF><INVBUY><INVTRAN><FITID>88032745229.5132.12212016.0<DTTRADE>20161221160000.000[-5:EST]<DTSETTLE>20161221160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>921937702<UNIQUEIDTYPE>CUSIP</SECID><UNITS>190.385<UNITPRICE>10.4<TOTAL>-1980.0<SUBACCTSEC>CASH<SUBAC
             CTFUND>OTHER</INVBUY><BUYTYPE>BUY</BUYMF><BUYMF><INVBUY><INVTRAN><FITID>88032745229.5132.01302017.0<DTTRADE>20170130160000.000[-5:EST]<DTSETTLE>20170130160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>921937702<UNIQUEIDTYPE>CUSIP</SECID><UNITS>671.141<UNITPRICE>10.43<TOTAL>-7000.0<SUBACCTSEC>CASH<SUBACCTFUND>OTHER</INVBUY><BUYTYPE>BUY</BUYMF><BUYMF><INVBUY><INVTRAN><FITID>88032745229.5132.01302017.1<DTTRADE>20170130160000.000[-5:EST]<DTSETTLE>20170130160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>921937702<UNIQUEIDTYPE>CUSIP</SECID><UNITS>287.632<UNITPRICE>10.43<TOTAL>-3000.0<SUBACCTSEC>CASH<SUBACCTFUND>OTHER</INVBUY><BUYTYPE>BUY</BUYMF><BUYMF><INVBUY><INVTRAN><FITID>88032745229.0569.12212016.0<DTTRADE>20161221160000.000[-5:EST]<DTSETTLE>20161221160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>921909818<UNIQUEIDTYPE>CUSIP</SECID><UNITS>143.615<UNITPRICE>24.51<TOTAL>-3520.0<SUBACCTSEC>CASH<SUBACCTFUND>OTHER</INVBUY><BUYTYPE>BUY</BUYMF><BUYMF><INVBUY><INVTRAN><FITID>88032745229.0569.12212016.1<DTTRADE>20161221160000.000[
-            -5:EST]<DTSETTLE>20161221160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>921909818<UNIQUEIDTYPE>CUSIP</SECID><UNITS>0.004<UNITPRICE>24.51<TOTAL>-0.11<SUBACCTSEC>CASH<SUBACCTFUND>OTHER</INVBUY><BUYTYPE>BUY</BUYMF><BUYMF><INVBUY><INVTRAN><FITID>88032745229.0569.01162018.0<DTTRADE>20180116160000.000[-5:EST]<DTSETTLE>20180116160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>921909818<UNIQUEIDTYPE>CUSIP</SECID><UNITS>136.292<UNITPRICE>31.88<TOTAL>-4345.0<SUBACCTSEC>CASH<SUBACCTFUND>OTHER</INVBUY><BUYTYPE>BUY</BUYMF><BUYMF><INVBUY><INVTRAN><FITID>88032745229.0585.01162018.0<DTTRADE>20180116160000.000[-5:EST]<DTSETTLE>20180116160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>922908728<UNIQUEIDTYPE>CUSIP</SECID><UNITS>16.698<UNITPRICE>69.17<TOTAL>-1155.0<SUBACCTSEC>CASH<SUBACCTFUND>OTHER</INVBUY><BUYTYPE>BUY</BUYMF><BUYMF><INVBUY><INVTRAN><FITID>88032745229.0585.01162018.1<DTTRADE>20180116160000.000[-5:EST]<DTSETTLE>20180116160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>922908728<UNIQUEIDTYPE>CUSIP</SECID><UNITS>0.022<UNITPRICE>69.)FAKE"; return *this; }
-  if (vars_map_.find("URL") == vars_map_.end()) {
+            -5:EST]<DTSETTLE>20161221160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>921909818<UNIQUEIDTYPE>CUSIP</SECID><UNITS>0.004<UNITPRICE>24.51<TOTAL>-0.11<SUBACCTSEC>CASH<SUBACCTFUND>OTHER</INVBUY><BUYTYPE>BUY</BUYMF><BUYMF><INVBUY><INVTRAN><FITID>88032745229.0569.01162018.0<DTTRADE>20180116160000.000[-5:EST]<DTSETTLE>20180116160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>921909818<UNIQUEIDTYPE>CUSIP</SECID><UNITS>136.292<UNITPRICE>31.88<TOTAL>-4345.0<SUBACCTSEC>CASH<SUBACCTFUND>OTHER</INVBUY><BUYTYPE>BUY</BUYMF><BUYMF><INVBUY><INVTRAN><FITID>88032745229.0585.01162018.0<DTTRADE>20180116160000.000[-5:EST]<DTSETTLE>20180116160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>922908728<UNIQUEIDTYPE>CUSIP</SECID><UNITS>16.698<UNITPRICE>69.17<TOTAL>-1155.0<SUBACCTSEC>CASH<SUBACCTFUND>OTHER</INVBUY><BUYTYPE>BUY</BUYMF><BUYMF><INVBUY><INVTRAN><FITID>88032745229.0585.01162018.1<DTTRADE>20180116160000.000[-5:EST]<DTSETTLE>20180116160000.000[-5:EST]</INVTRAN><SECID><UNIQUEID>922908728<UNIQUEIDTYPE>CUSIP</SECID><UNITS>0.022<UNITPRICE>69.)FAKE"; return nullptr; }
+  const string* url = vars_map_.Find(kUrlVar);
+  if (!url) {
     error_string_ = "URL not in vars map";
-    return *this;
+    return nullptr;
   }
   if (request_template_.empty()) {
     error_string_ = "no request template was added";
-    return *this;
+    return nullptr;
+  }
+  std::size_t request_size;
+  string missing;
+  if (!request_template_.RenderedSize(vars_map_, &request_size, &missing)) {
+    error_string_ = "Unspecified variable: " + missing;
+    return nullptr;
   }
 
-  CURL *curl = curl_easy_init();
+  if (min_health_ > 0 && institution_id_ >= 0) {
+    try {
+      double score = EndpointHealth::Global().Score(institution_id_,
+                                                    time(nullptr));
+      if (score < min_health_) {
+        error_string_ = "Skipping institution " +
+            std::to_string(institution_id_) + ", health score " +
+            std::to_string(score) + " is below " + std::to_string(min_health_);
+        return nullptr;
+      }
+    } catch (const string& msg) {
+      error_string_ = msg;
+      return nullptr;
+    }
+  }
+
+  // A pooled handle keeps the server's connection and TLS session open from
+  // an earlier request to the same origin.
+  CURL *curl = CurlHandlePool::Global().Acquire(*url);
   if (!curl) {
     error_string_ = "Could not initialize curl";
-    return *this;
+    return nullptr;
   }
 
-  string request_str = request();
-  curl_easy_setopt(curl, CURLOPT_URL, vars_map_["URL"].c_str());
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request_str.c_str());
-
-  struct curl_slist *headerlist = NULL;
-  headerlist = curl_slist_append(headerlist, "Content-type: application/x-ofx");
-  headerlist = curl_slist_append(headerlist, "Accept: */*, application/x-ofx");
-
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerlist);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlWriteToString);
+  // Buffer the response in a recycled string reserved for the size of the
+  // institution's last response. A Content-Length reserves it exactly.
+  if (!sink_) {
+    std::size_t expected_size = institution_id_ >= 0
+        ? ResponseBufferPool::Global().ExpectedSize(institution_id_) : 0;
+    RecycleResponse();
+    response_ = ResponseBufferPool::Global().Take(expected_size);
+  }
+  transfer_ = curl;
+  response_begun_ = false;
+
+  // Stream the template's literals and the variable values to curl instead
+  // of rendering the request into one string first.
+  request_reader_.reset(new TemplateReader(request_template_, vars_map_));
+  curl_easy_setopt(curl, CURLOPT_URL, url->c_str());
+  curl_easy_setopt(curl, CURLOPT_POST, 1L);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                   (curl_off_t) request_size);
+  curl_easy_setopt(curl, CURLOPT_READFUNCTION, CurlReadTemplate);
+  curl_easy_setopt(curl, CURLOPT_READDATA, (void*) request_reader_.get());
+  curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, CurlSeekTemplate);
+  curl_easy_setopt(curl, CURLOPT_SEEKDATA, (void*) request_reader_.get());
+
+  request_headers_ = curl_slist_append(request_headers_,
+                                       "Content-type: application/x-ofx");
+  request_headers_ = curl_slist_append(request_headers_,
+                                       "Accept: */*, application/x-ofx");
+
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request_headers_);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlWriteToSink);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*) this);
-  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
   curl_easy_setopt(curl, CURLOPT_TIMEOUT, REQUEST_TIMEOUT /* seconds */);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, (void*) this);
+  return curl;
+}
 
-  CURLcode res = curl_easy_perform(curl);
+OfxGetContext& OfxGetContext::FinishPost(CURL *curl, CURLcode res) {
+  long http_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
 
-  curl_easy_cleanup(curl);
-  curl_slist_free_all(headerlist);
+  if (res == CURLE_OK) {
+    CurlHandlePool::Global().RecordTransfer(curl);
+    curl_off_t response_size = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &response_size);
+    if (institution_id_ >= 0) {
+      ResponseBufferPool::Global().RecordSize(institution_id_, response_size);
+    }
+  }
+  transfer_ = nullptr;
+  CurlHandlePool::Global().Release(*vars_map_.Find(kUrlVar), curl);
+  curl_slist_free_all(request_headers_);
+  request_headers_ = nullptr;
+  request_reader_.reset();
+
+  // curl succeeds on HTTP errors too, but their body is an error page, not
+  // the response.
+  try {
+    response_sink()->Finish(res == CURLE_OK && http_code < 400);
+  } catch (const string& msg) {
+    if (error_string_.empty()) error_string_ = msg;
+  }
 
-  if (res != CURLE_OK) {
+  // A sink that aborted the transfer says nothing about the server.
+  if (institution_id_ >= 0 && res != CURLE_WRITE_ERROR) {
+    // Server errors count against the endpoint; 4xx usually means a bad
+    // request or credentials, not a broken server.
+    if (res == CURLE_OK && http_code < 500) {
+      EndpointHealth::Global().RecordSuccess(institution_id_, time(nullptr));
+    } else {
+      EndpointHealth::Global().RecordFailure(institution_id_, time(nullptr));
+    }
+  }
+
+  // Keep the reason a sink gave for aborting.
+  if (res != CURLE_OK && error_string_.empty()) {
     error_string_ = "Curl error: " + std::to_string(res);
-    return *this;
   }
   return *this;
 }
 
-static size_t CurlWriteToString(char *ptr, size_t size, size_t nmemb, void *userdata) {
+static size_t CurlWriteToSink(char *ptr, size_t size, size_t nmemb, void *userdata) {
   OfxGetContext* context = static_cast<OfxGetContext*>(userdata);
-  if (size != 1) {
-    char err[255];
-    sprintf(err, "In response, expected char size 1, got %ld", size);
-    context->error_string_ = string(err);
+  ResponseSink* sink = context->response_sink();
+  try {
+    if (!context->response_begun_) {
+      curl_off_t content_length = -1;
+      curl_easy_getinfo(context->transfer_, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                        &content_length);
+      context->response_begun_ = true;
+      sink->Begin(content_length);
+    }
+    if (!sink->Write(ptr, size * nmemb)) {
+      context->error_string_ = "Response sink aborted the transfer";
+      return 0;
+    }
+  } catch (const string& msg) {
+    // Exceptions must not unwind through curl. Abort the transfer instead.
+    context->error_string_ = msg;
+    return 0;
   }
-  string to_add;
-  to_add.resize(nmemb);
-  memcpy((void*) to_add.c_str(), (void*) ptr, nmemb);
-  context->response_ += to_add;
   return size * nmemb;
 }
 
-size_t HeaderCallback(char *buffer, size_t size, size_t nitems,
-                      void *userdata) {
-  cout << "Read header: " << buffer;
-  return nitems * size;
+static size_t CurlReadTemplate(char *buffer, size_t size, size_t nitems,
+                               void *userdata) {
+  return static_cast<TemplateReader*>(userdata)->Read(buffer, size * nitems);
 }
 
-
-
-
-string OfxDate() {
-  time_t now = time(nullptr);
-  struct tm* ltime = localtime(&now);
-  char time_str[255];
-  sprintf(time_str, "%04d%02d%02d%02d%02d%02d.000",
-          1900 + ltime->tm_year, 1 + ltime->tm_mon, ltime->tm_mday,
-          ltime->tm_hour, ltime->tm_min, ltime->tm_sec);
-  return time_str;
+// curl rewinds the body to resend it, eg after a redirect.
+static int CurlSeekTemplate(void *userdata, curl_off_t offset, int origin) {
+  if (origin != SEEK_SET || offset != 0) {
+    return CURL_SEEKFUNC_CANTSEEK;
+  }
+  static_cast<TemplateReader*>(userdata)->Rewind();
+  return CURL_SEEKFUNC_OK;
 }
 
 void InitVars(VarsMap* vars) {
   vars->clear();
-  (*vars)["OFXDATE"] = OfxDate();
+  (*vars)[kOfxDateVar] = OfxDate(time(nullptr));
+  (*vars)[kTrnUidVar] = NewOfxUid();
+  (*vars)[kNewFileUidVar] = NewOfxUid();
 }
 
 
+vector<string> GetMissingRequestVars(const RequestTemplate& request_template,
+                                     const VarsMap& vars) {
+  return request_template.MissingVars(vars, true);
+}
+
 vector<string> GetMissingRequestVars(const string& request_template,
                                      const VarsMap& vars) {
-  vector<string> missing;
-  for (std::size_t i = 0; i < request_template.size(); i++) {
-    if (request_template[i] == '$') {
-      std::size_t j;
-      for (j = i + 1; j < request_template.size(); j++) {
-        if (!isupper(request_template[j])) {
-          break;
-        }
-      }
-      string var = request_template.substr(i + 1, j - i - 1);
-      VarsMap::const_iterator it = vars.find(var);
-      if (it == vars.end() || it->second.empty()) {
-        missing.push_back(var);
-      }
-    }
-  }
-  return missing;
+  return GetMissingRequestVars(RequestTemplate(request_template), vars);
 }
 
 } // namespace: ofxget
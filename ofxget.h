@@ -2,9 +2,16 @@
 #define __OFX_GET_H__
 
 #include <map>
+#include <memory>
 #include <string>
 
+#include <curl/curl.h>
+
+#include "ofxhealth.h"
 #include "ofxhome.h"
+#include "ofxrequests.h"
+#include "ofxsink.h"
+#include "ofxtemplate.h"
 
 namespace ofxget {
 
@@ -24,6 +31,8 @@ namespace ofxget {
 //     
 //     string request = BuildRequest(
 //       GetRequestTemplate("requests/" + string(request_filename)), vars);
+//     // The standard templates are also built in, eg
+//     // BuiltinRequestTemplate("investment.txt").
 //     string response = PostRequest(request, vars["URL"]);
 //     cout << "RESPONSE" << endl << endl << response << endl;
 //   } catch(const string& msg) {
@@ -33,14 +42,12 @@ namespace ofxget {
 // Request timeout when posting requests in seconds.
 #define REQUEST_TIMEOUT 10
 
-// VarsMap is one half of the data used for building a request. The other is the
-// request template. VarsMap contains all of the variables that will be
-// substituted into the request. For example, VarMap["USERID"] = "myid".
-typedef map<string, string> VarsMap;
-
 class OfxGetContext {
  public:
   OfxGetContext();
+  ~OfxGetContext();
+  OfxGetContext(const OfxGetContext&) = delete;
+  OfxGetContext& operator=(const OfxGetContext&) = delete;
 
   // Return to its original state.
   void Reset();
@@ -50,48 +57,101 @@ class OfxGetContext {
   OfxGetContext& AddApp(const string& name);
 
   // Add institution vars. The id value refers to an institution in the
-  // institutions.txt file.
+  // process wide InstitutionDirectory, loaded from institutions.dir or
+  // institutions.txt on first use.
   OfxGetContext& AddInstitution(int id);
 
+  // Skip PostRequest with an error instead of contacting the server when the
+  // institution's EndpointHealth score is below min_score. Outcomes of
+  // requests are always recorded in EndpointHealth::Global().
+  OfxGetContext& SkipUnhealthy(double min_score = DEFAULT_MIN_HEALTH);
+
   // Add user passwords and other account info to a VarsMap. These values are
   // read from a plain text file. This is not safe and should only be used for
   // testing purposes.
   OfxGetContext& AddPasswordsForTest(int id, const char* filename);
 
   // Read a request template from a file (eg, investment.txt). Returns empty
-  // string on error.
+  // string on error. Files are read once and kept in TemplateCache::Global().
   string GetRequestTemplate(const string& filename);
 
+  // Use the request template in a file, compiled once per process by
+  // TemplateCache::Global().
+  OfxGetContext& AddRequestTemplateFile(const string& filename);
+
   // Substitute the vars into a request template. A fully working request is
-  // returned.
+  // returned. The template is compiled once here; pass a RequestTemplate to
+  // reuse one across contexts.
   OfxGetContext& AddRequestTemplate(const string& request_template);
+  OfxGetContext& AddRequestTemplate(const RequestTemplate& request_template);
 
   // Send a request to an OFX server. url will be taken from a VarsMap using the
   // URL key if the institution was loaded from AddInstitution.
   OfxGetContext& PostRequest();
 
+  // PostRequest in two halves, for running many transfers at once (see
+  // OfxMulti). StartPost returns a handle from CurlHandlePool::Global() set
+  // up to send the request, with CURLOPT_PRIVATE pointing to this context,
+  // or null and sets the error. FinishPost records the result of the
+  // transfer and gives the handle back. The context must not change in
+  // between.
+  CURL* StartPost();
+  OfxGetContext& FinishPost(CURL* curl, CURLcode result);
+
   // Return the request based on the request template and vars. On error, an
   // empty string is returned.
   string request();
 
-  // Return the response. Only populated after calling PostRequest. On error,
-  // an empty string is returned.
+  // Return the response. Only populated after calling PostRequest, unless a
+  // response sink was set. On error, an empty string is returned.
   const string& response() { return response_; }
 
+  // Stream the response of PostRequest to sink as it arrives instead of
+  // buffering it for response(). sink must outlive the transfer. Null
+  // restores buffering.
+  OfxGetContext& SetResponseSink(ResponseSink* sink) {
+    sink_ = sink;
+    return *this;
+  }
+  ResponseSink* response_sink() { return sink_ ? sink_ : &buffer_sink_; }
+
+  // Give the response buffer back to ResponseBufferPool::Global() for later
+  // requests once done with response(), which is then empty. Also done when
+  // the context is destroyed.
+  void RecycleResponse();
+
   bool is_error() { return !error_string_.empty(); }
   const string& error_string() { return error_string_; }
 
  public: // TODO: private
   VarsMap vars_map_;
   string error_string_;
-  string request_template_;
+  RequestTemplate request_template_;
   string response_;
+  // OFX Home id from AddInstitution, or -1.
+  int institution_id_;
+  // Minimum health score for PostRequest, or 0 to always send.
+  double min_health_;
+  // The request body and headers of a transfer between StartPost and
+  // FinishPost.
+  std::unique_ptr<TemplateReader> request_reader_;
+  struct curl_slist* request_headers_ = nullptr;
+  // The handle of the transfer, and whether the sink has seen the response
+  // begin.
+  CURL* transfer_ = nullptr;
+  bool response_begun_ = false;
+  // Null to buffer the response in response_ with buffer_sink_.
+  ResponseSink* sink_ = nullptr;
+  StringSink buffer_sink_{&response_};
 };
 
 // Initialize a vars map with common variables needed to send an OFX request.
 void InitVars(VarsMap* vars);
 
-// Return a vector of all the request vars that are missing.
+// Return a vector of all the request vars that are missing or empty, each
+// once.
+vector<string> GetMissingRequestVars(const RequestTemplate& request_template,
+                                     const VarsMap& vars);
 vector<string> GetMissingRequestVars(const string& request_template,
                                      const VarsMap& vars);
 
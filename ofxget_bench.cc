@@ -0,0 +1,371 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ofxbatch.h"
+#include "ofxbuilder.h"
+#include "ofxdirectory.h"
+#include "ofxget.h"
+#include "ofxhome.h"
+#include "ofxhttp.h"
+#include "ofxtime.h"
+
+using ofxget::BatchRenderer;
+using ofxget::DirRecord;
+using ofxget::FindInstitutionByName;
+using ofxget::Institution;
+using ofxget::InstitutionDirectory;
+using ofxget::OfxDumpStringToInstitutions;
+using ofxget::OfxGetContext;
+using ofxget::RequestTemplate;
+using ofxget::VarsMap;
+using ofxget::VarsTable;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+// Microbenchmarks for ofxget. Run from the repo root so institutions.txt can
+// be found:
+//
+//   make clean && make CFLAGS=-O2 ofxget_bench && ./ofxget_bench
+
+// Keeps results alive so the optimizer can not drop the benchmarked work.
+static volatile std::size_t g_sink;
+
+// Run fn iterations times and print the mean time per call.
+template <typename Fn>
+static void Bench(const string& name, int iterations, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    fn(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  cout << name << ": " << ns / iterations << " ns/op" << endl;
+}
+
+static vector<Institution> LoadInstitutions() {
+  std::ifstream f("institutions.txt");
+  if (!f.is_open()) {
+    throw string("Could not open institutions.txt");
+  }
+  std::stringstream dump;
+  dump << f.rdbuf();
+  return OfxDumpStringToInstitutions(dump.str());
+}
+
+static void BenchDirectoryLookups(const vector<Institution>& insts) {
+  auto dir = InstitutionDirectory::FromInstitutions(insts);
+  const int kIterations = 200000;
+
+  Bench("scan by name (FindInstitutionByName)", kIterations / 100,
+        [&](int i) {
+          g_sink = (std::size_t) FindInstitutionByName(
+              insts, insts[i % insts.size()].name);
+        });
+  Bench("scan by fid", kIterations / 100, [&](int i) {
+    const string& fid = insts[i % insts.size()].fid;
+    for (const Institution& inst : insts) {
+      if (inst.fid == fid) {
+        g_sink = inst.ofxhome_id;
+        break;
+      }
+    }
+  });
+  Bench("scan by org+fid", kIterations / 100, [&](int i) {
+    const Institution& want = insts[i % insts.size()];
+    for (const Institution& inst : insts) {
+      if (inst.org == want.org && inst.fid == want.fid) {
+        g_sink = inst.ofxhome_id;
+        break;
+      }
+    }
+  });
+  Bench("scan by host", kIterations / 100, [&](int i) {
+    std::string_view host =
+        InstitutionDirectory::UrlHost(insts[i % insts.size()].url);
+    for (const Institution& inst : insts) {
+      if (InstitutionDirectory::UrlHost(inst.url) == host) {
+        g_sink = inst.ofxhome_id;
+        break;
+      }
+    }
+  });
+
+  vector<const DirRecord*> found;
+  Bench("scan profiles for invstmtmsgset", 1000, [&](int i) {
+    std::size_t count = 0;
+    for (const Institution& inst : insts) {
+      auto it = inst.profile.find("invstmtmsgset");
+      if (it != inst.profile.end() && it->second == "true") count++;
+    }
+    g_sink = count;
+  });
+  Bench("scan message set column", 1000, [&](int i) {
+    found.clear();
+    dir->FindByMessageSets(ofxget::kInvestmentMsgSet, &found);
+    g_sink = found.size();
+  });
+
+  Bench("hash by id", kIterations, [&](int i) {
+    g_sink = (std::size_t) dir->FindById(insts[i % insts.size()].ofxhome_id);
+  });
+  Bench("hash by fid", kIterations, [&](int i) {
+    g_sink = (std::size_t) dir->FindByFid(insts[i % insts.size()].fid);
+  });
+  Bench("hash by org+fid", kIterations, [&](int i) {
+    const Institution& want = insts[i % insts.size()];
+    g_sink = (std::size_t) dir->FindByOrgFid(want.org, want.fid);
+  });
+  Bench("hash by host", kIterations, [&](int i) {
+    g_sink = (std::size_t) dir->FindByHost(
+        InstitutionDirectory::UrlHost(insts[i % insts.size()].url));
+  });
+}
+
+static void BenchSearch(const vector<Institution>& insts) {
+  auto dir = InstitutionDirectory::FromInstitutions(insts);
+  dir->Search("warm up", 1);
+  const char* queries[] = {"v", "va", "van", "vang", "vanguard", "chase cc",
+                           "bank of amer", "fidelty"};
+  const int kQueries = sizeof(queries) / sizeof(queries[0]);
+  Bench("trigram search top 10", 20000, [&](int i) {
+    g_sink = dir->Search(queries[i % kQueries], 10).size();
+  });
+}
+
+// The replace loop request() used before templates were compiled.
+static string ReplaceLoopRequest(const string& request_template,
+                                 const VarsMap& vars) {
+  string subbed = request_template;
+  for (std::size_t i = 0; i < subbed.size(); i++) {
+    if (subbed[i] == '$') {
+      std::size_t j;
+      for (j = i + 1; j < subbed.size(); j++) {
+        if (!isupper(subbed[j])) {
+          break;
+        }
+      }
+      const string* value = vars.Find(subbed.substr(i + 1, j - i - 1));
+      if (!value) {
+        return "";
+      }
+      subbed.replace(i, j - i, *value);
+    }
+  }
+  return subbed;
+}
+
+static void BenchRequest() {
+  OfxGetContext context;
+  string text = context.GetRequestTemplate("requests/investment.txt");
+  if (context.is_error()) {
+    throw context.error_string();
+  }
+  VarsMap vars = context.vars_map_;
+  const std::pair<const char*, const char*> values[] = {
+      {"USERID", "user"}, {"USERPASS", "password"}, {"ORG", "Vanguard"},
+      {"FID", "15103"}, {"APPID", "QWIN"}, {"APPVER", "2500"},
+      {"BROKERID", "vanguard.com"}, {"ACCTID", "0123456789"}};
+  for (const auto& value : values) {
+    vars[value.first] = value.second;
+  }
+
+  RequestTemplate compiled(text);
+  string rendered, missing;
+  compiled.Render(vars, &rendered, &missing);
+  if (rendered != ReplaceLoopRequest(text, vars)) {
+    throw string("Compiled and replace loop requests differ");
+  }
+  const int kIterations = 200000;
+  Bench("render investment.txt (replace loop)", kIterations, [&](int i) {
+    g_sink = ReplaceLoopRequest(text, vars).size();
+  });
+  Bench("render investment.txt (compiled)", kIterations, [&](int i) {
+    string out;
+    compiled.Render(vars, &out, &missing);
+    g_sink = out.size();
+  });
+
+  ofxget::OfxSignon signon;
+  signon.dtclient = *vars.Find(ofxget::kOfxDateVar);
+  signon.userid = "user";
+  signon.userpass = "password";
+  signon.org = "Vanguard";
+  signon.fid = "15103";
+  signon.appid = "QWIN";
+  signon.appver = "2500";
+  ofxget::OfxAccount account;
+  account.brokerid = "vanguard.com";
+  account.acctid = "0123456789";
+  Bench("build investment request (OfxRequestBuilder)", kIterations,
+        [&](int i) {
+    string out;
+    ofxget::OfxRequestBuilder(ofxget::kOfxSgml102, &out)
+        .Begin(*vars.Find(ofxget::kNewFileUidVar)).Signon(signon)
+        .ClientCookie("4")
+        .InvestmentStatement(*vars.Find(ofxget::kTrnUidVar), account,
+                             "19000101", signon.dtclient)
+        .End();
+    g_sink = out.size();
+  });
+
+  Bench("missing vars (rescan template text)", kIterations, [&](int i) {
+    g_sink = ofxget::GetMissingRequestVars(text, vars).size();
+  });
+  Bench("missing vars (compiled, MissingKnownVars)", kIterations, [&](int i) {
+    g_sink = compiled.MissingKnownVars(vars, true);
+  });
+
+  // A batch of accounts rendered with a context per account, as the nightly
+  // job did, and with one BatchRenderer.
+  const int kAccounts = 40000;
+  VarsTable accounts({"USERID", "USERPASS", "ACCTID"});
+  accounts.Reserve(kAccounts, 10);
+  vector<string> ids;
+  for (int i = 0; i < kAccounts; i++) {
+    ids.push_back(std::to_string(1000000000 + i));
+    accounts.AddRow({ids.back(), "password", ids.back()});
+  }
+  RequestTemplate builtin = ofxget::BuiltinRequestTemplate("investment.txt");
+  Bench("render 40k accounts (context per account)", 5, [&](int i) {
+    std::size_t total = 0;
+    for (int row = 0; row < kAccounts; row++) {
+      OfxGetContext account;
+      account.vars_map_ = vars;
+      account.vars_map_["USERID"] = ids[row];
+      account.vars_map_["USERPASS"] = "password";
+      account.vars_map_["ACCTID"] = ids[row];
+      account.AddRequestTemplate(text);
+      total += account.request().size();
+    }
+    g_sink = total;
+  });
+  BatchRenderer renderer(builtin, accounts, vars);
+  Bench("render 40k accounts (BatchRenderer::Render)", 5, [&](int i) {
+    std::size_t total = 0;
+    for (int row = 0; row < kAccounts; row++) {
+      total += renderer.Render(row).size();
+    }
+    g_sink = total;
+  });
+  vector<std::string_view> requests;
+  Bench("render 40k accounts (BatchRenderer::RenderAll)", 5, [&](int i) {
+    renderer.RenderAll(&requests);
+    g_sink = requests.size();
+  });
+}
+
+static void BenchOfxDate() {
+  Bench("OfxDate (localtime + sprintf)", 1000000, [&](int i) {
+    time_t now = time(nullptr);
+    struct tm* ltime = localtime(&now);
+    char time_str[255];
+    sprintf(time_str, "%04d%02d%02d%02d%02d%02d.000",
+            1900 + ltime->tm_year, 1 + ltime->tm_mon, ltime->tm_mday,
+            ltime->tm_hour, ltime->tm_min, ltime->tm_sec);
+    g_sink = time_str[13];
+  });
+  Bench("FormatOfxDate (cached minute)", 1000000, [&](int i) {
+    char text[OFX_DATE_MAX_SIZE];
+    g_sink = ofxget::FormatOfxDate(time(nullptr), true, text);
+  });
+}
+
+// A 2MB investment history arriving in 16KB chunks, written the way the curl
+// write callback used to (a temporary string per chunk, then +=) and into a
+// pooled buffer reserved from Content-Length.
+static void BenchResponseWrite() {
+  const std::size_t kResponseSize = 2 << 20;
+  const std::size_t kChunkSize = 16 << 10;
+  string chunk(kChunkSize, 'x');
+  Bench("write 2MB response (temporary per chunk)", 200, [&](int i) {
+    string response;
+    for (std::size_t n = 0; n < kResponseSize; n += kChunkSize) {
+      string to_add;
+      to_add.resize(kChunkSize);
+      memcpy((void*) to_add.c_str(), chunk.data(), kChunkSize);
+      response += to_add;
+    }
+    g_sink = response.size();
+  });
+  ofxget::ResponseBufferPool& pool = ofxget::ResponseBufferPool::Global();
+  Bench("write 2MB response (pooled, reserved)", 200, [&](int i) {
+    string response = pool.Take(kResponseSize);
+    for (std::size_t n = 0; n < kResponseSize; n += kChunkSize) {
+      response.append(chunk.data(), kChunkSize);
+    }
+    g_sink = response.size();
+    pool.Give(std::move(response));
+  });
+}
+
+// Bytes allocated with operator new and not yet deleted. Every allocation is
+// prefixed with its size so that delete can subtract it.
+static std::atomic<std::size_t> g_heap_in_use(0);
+static const std::size_t kHeapPrefix = alignof(std::max_align_t);
+
+void* operator new(std::size_t size) {
+  char* p = static_cast<char*>(malloc(size + kHeapPrefix));
+  if (!p) throw std::bad_alloc();
+  *reinterpret_cast<std::size_t*>(p) = size;
+  g_heap_in_use += size;
+  return p + kHeapPrefix;
+}
+
+void operator delete(void* ptr) noexcept {
+  if (!ptr) return;
+  char* p = static_cast<char*>(ptr) - kHeapPrefix;
+  g_heap_in_use -= *reinterpret_cast<std::size_t*>(p);
+  free(p);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  operator delete(ptr);
+}
+
+static std::size_t HeapInUse() {
+  return g_heap_in_use;
+}
+
+// Compare the heap used by vector<Institution> with the interned directory.
+static void ReportDirectoryMemory(const vector<Institution>& insts) {
+  std::size_t before = HeapInUse();
+  vector<Institution> copy = insts;
+  std::size_t vector_bytes = HeapInUse() - before;
+
+  before = HeapInUse();
+  auto dir = InstitutionDirectory::FromInstitutions(insts);
+  std::size_t dir_bytes = HeapInUse() - before;
+  std::size_t image_bytes = ofxget::CompileInstitutions(insts).size();
+
+  cout << "vector<Institution> heap: " << vector_bytes << " bytes" << endl;
+  cout << "InstitutionDirectory heap: " << dir_bytes << " bytes ("
+       << image_bytes << " image, rest indexes)" << endl;
+}
+
+int main() {
+  try {
+    vector<Institution> insts = LoadInstitutions();
+    cout << insts.size() << " institutions" << endl;
+    ReportDirectoryMemory(insts);
+    BenchDirectoryLookups(insts);
+    BenchSearch(insts);
+    BenchRequest();
+    BenchOfxDate();
+    BenchResponseWrite();
+  } catch (const string& msg) {
+    cout << msg << endl;
+    return 1;
+  }
+  return 0;
+}
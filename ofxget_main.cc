@@ -8,9 +8,12 @@
 #include "clap/include/cmdline.hh"
 
 #include "ofxget.h"
+#include "ofxhttp.h"
 
+using ofxget::EndpointHealth;
 using ofxget::GetMissingRequestVars;
 using ofxget::OfxGetContext;
+using ofxget::RequestTemplate;
 using std::cin;
 using std::cout;
 using std::endl;
@@ -24,21 +27,37 @@ int main(int argc, char** argv) {
   CmdArgStr request_filename('r', "request", "request_file", "Request file name under the requests directory. See investment.txt for an example.");
   CmdArgStr passwords_filename('r', "passwords", "passwords_file", "Optional passwords file. If used, supplies passwords for an institution. See example_passwords.txt. Storing passwords in plain text is not safe. This file should only be used for testing purposes.", CmdArg::isOPT);
   CmdArgInt institution('i', "institution", "institution_id", "Institution id. Chooses which institution to read from institutions.txt.");
-  CmdLine cmd(argv[0], &request_filename, &institution, &passwords_filename, nullptr);
+  CmdArgStr health_filename('h', "health", "health_file", "Optional endpoint health history. If used, the request is skipped when the institution is known to be unreachable, and the outcome is recorded in the file.", CmdArg::isOPT);
+  CmdLine cmd(argv[0], &request_filename, &institution, &passwords_filename, &health_filename, nullptr);
   cmd.parse(argc, argv);
 
   OfxGetContext ofxget;
-  string request_template = ofxget.GetRequestTemplate("requests/" + string(request_filename));
-  ofxget.AddApp("QuickBooks_2008").AddInstitution(institution)
-      .AddRequestTemplate(request_template);
+  if (health_filename.isFound()) {
+    try {
+      EndpointHealth::Global().Load(string(health_filename));
+    } catch (const string& msg) {
+      cout << "ERROR" << msg << endl;
+      return 1;
+    }
+    ofxget.SkipUnhealthy();
+  }
+  // The standard templates are built in. Other names are read from requests/.
+  RequestTemplate request_template =
+      ofxget::BuiltinRequestTemplate(string(request_filename));
+  ofxget.AddApp("QuickBooks_2008").AddInstitution(institution);
+  if (request_template.empty()) {
+    ofxget.AddRequestTemplateFile("requests/" + string(request_filename));
+  } else {
+    ofxget.AddRequestTemplate(request_template);
+  }
   if (passwords_filename.isFound()) {
     ofxget.AddPasswordsForTest(institution, passwords_filename);
   } else {
     ofxget.AddPasswordsForTest(institution, "passwords.txt");
   }
 
-  vector<string> missing_vars = GetMissingRequestVars(request_template,
-                                                      ofxget.vars_map_);
+  vector<string> missing_vars = GetMissingRequestVars(
+      ofxget.request_template_, ofxget.vars_map_);
   if (!missing_vars.empty()) {
     cout << "Enter missing account info:" << endl;
   }
@@ -50,12 +69,23 @@ int main(int argc, char** argv) {
   }
 
   ofxget.PostRequest();
+  if (health_filename.isFound()) {
+    try {
+      EndpointHealth::Global().Save(string(health_filename));
+    } catch (const string& msg) {
+      cout << "ERROR" << msg << endl;
+    }
+  }
   if (ofxget.is_error()) {
     cout << "ERROR" << ofxget.error_string() << endl;
   } else {
     cout << "REQUEST" << endl << ofxget.request() << endl;
     cout << "RESPONSE" << endl << endl << ofxget.response() << endl;
   }
+  ofxget::ConnectionStats stats = ofxget::CurlHandlePool::Global().stats();
+  cout << "CONNECTIONS " << stats.new_connections << " new for "
+       << stats.transfers << " requests, reuse rate " << stats.reuse_rate()
+       << endl;
 
   return 0;
 }
@@ -0,0 +1,419 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <thread>
+
+#include "ofxbatch.h"
+#include "ofxbuilder.h"
+#include "ofxget.h"
+#include "ofxhttp.h"
+#include "ofxmulti.h"
+#include "ofxrequests.h"
+#include "ofxsink.h"
+#include "ofxtime.h"
+#include "ofxuid.h"
+#include "ofxtemplate.h"
+
+using ofxget::BatchRenderer;
+using ofxget::BuiltinRequestTemplate;
+using ofxget::OfxGetContext;
+using ofxget::RequestTemplate;
+using ofxget::VarsMap;
+using ofxget::VarsTable;
+
+void assertEq(const string& actual, const string& expected) {
+  if (actual != expected) {
+    std::cout << '"' << actual << '"'  << " != " << '"' << expected << '"'
+              << std::endl;
+  }
+}
+
+int main() {
+  VarsMap vars;
+  vars["USERID"] = "me";
+  vars["USERPASS"] = "pa$USERIDss";
+  RequestTemplate request("<USERID>$USERID\r\n<USERPASS>$USERPASS\r\n$");
+  string out, missing;
+  assertEq(request.Render(vars, &out, &missing) ? out : "missing " + missing,
+           "missing ");
+  vars[""] = "$";
+  assertEq(request.Render(vars, &out, &missing) ? out : missing,
+           "<USERID>me\r\n<USERPASS>pa$USERIDss\r\n$");
+  assertEq(RequestTemplate("$FID").Render(vars, &out, &missing) ? out : missing,
+           "FID");
+  assertEq(std::to_string(RequestTemplate("a$FIDb$ORG").segment_count()),
+           "4");
+
+  // Known variables live in slots, others spill.
+  VarsMap store;
+  store["FID"] = "15103";
+  store[ofxget::kAcctIdVar] = "1";
+  store["CUSTOM"] = "x";
+  assertEq(std::to_string(store.known_set()),
+           std::to_string((1 << ofxget::kFidVar) | (1 << ofxget::kAcctIdVar)));
+  assertEq(*store.Find(ofxget::kFidVar), "15103");
+  assertEq(store.Find("ORG") ? "found" : "", "");
+  string listed;
+  store.ForEach([&](std::string_view name, const string& value) {
+    listed += string(name) + "=" + value + ";";
+  });
+  assertEq(listed, "FID=15103;ACCTID=1;CUSTOM=x;");
+  store.Erase("CUSTOM");
+  store.Erase("FID");
+  assertEq(store.Find("CUSTOM") || store.Find("FID") ? "found" : "", "");
+  RequestTemplate slots("$FID$CUSTOM");
+  assertEq(std::to_string(slots.begin()[0].var) + " " +
+           std::to_string(slots.begin()[1].var),
+           std::to_string(ofxget::kFidVar) + " -1");
+
+  // Missing variables are reported once each.
+  VarsMap partial;
+  partial["OFXDATE"] = "20180421105945.000";
+  partial["USERID"] = "";
+  partial["APPID"] = "QWIN";
+  string names;
+  for (const string& name : ofxget::GetMissingRequestVars(
+           BuiltinRequestTemplate("accounts.txt"), partial)) {
+    names += name + " ";
+  }
+  assertEq(names, "USERID USERPASS ORG FID APPVER TRNUID NEWFILEUID ");
+  RequestTemplate others("$X$ORG$Y$X$ORG");
+  names.clear();
+  for (const string& name : others.MissingVars(partial, false)) {
+    names += name + " ";
+  }
+  assertEq(names, "ORG X Y ");
+  assertEq(std::to_string(others.MissingKnownVars(partial, false)),
+           std::to_string(1 << ofxget::kOrgVar));
+
+  // Reading a template in chunks of any size gives the rendered request.
+  RequestTemplate investment = BuiltinRequestTemplate("investment.txt");
+  VarsMap full = partial;
+  for (const char* name : {"USERID", "USERPASS", "ORG", "FID", "APPVER",
+                           "BROKERID", "ACCTID", "TRNUID", "NEWFILEUID"}) {
+    full[name] = string("value of ") + name;
+  }
+  string rendered;
+  investment.Render(full, &rendered, &missing);
+  std::size_t size = 0;
+  assertEq(investment.RenderedSize(full, &size, &missing) ?
+           std::to_string(size) : missing, std::to_string(rendered.size()));
+  ofxget::TemplateReader reader(investment, full);
+  for (std::size_t chunk = 1; chunk < 40; chunk++) {
+    string streamed;
+    char buffer[40];
+    reader.Rewind();
+    while (std::size_t n = reader.Read(buffer, chunk)) {
+      streamed.append(buffer, n);
+    }
+    assertEq(streamed, rendered);
+  }
+
+  OfxGetContext context;
+  context.vars_map_["ACCTID"] = "1$2";
+  context.AddRequestTemplate("<ACCTID>$ACCTID<FID>$FID");
+  assertEq(context.request(), "");
+  assertEq(context.error_string(), "Unspecified variable: FID");
+
+  // Built-in templates match the files they were made from.
+  for (const char* name : {"accounts.txt", "bank.txt", "investment.txt",
+                           "investment203.txt"}) {
+    OfxGetContext files;
+    string text = files.GetRequestTemplate(string("requests/") + name);
+    assertEq(string(BuiltinRequestTemplate(name).text()), text);
+    assertEq(std::to_string(BuiltinRequestTemplate(name).segment_count()),
+             std::to_string(RequestTemplate(text).segment_count()));
+  }
+
+  // Batches render the same requests as one OfxGetContext per account.
+  VarsTable accounts({"USERID", "ACCTID"});
+  accounts.AddRow({"alice", "1$ACCTID"});
+  accounts.AddRow({"bob-with-a-long-name", ""});
+  accounts.AddRow({"", "3"});
+  VarsMap shared = vars;
+  shared["ACCTID"] = "shadowed by the table";
+  RequestTemplate batch_request("$USERPASS:$USERID/$ACCTID$USERID.");
+  BatchRenderer renderer(batch_request, accounts, shared);
+  vector<string> expected;
+  for (std::size_t row = 0; row < accounts.rows(); row++) {
+    VarsMap account = shared;
+    account["USERID"] = string(accounts.value(row, 0));
+    account["ACCTID"] = string(accounts.value(row, 1));
+    batch_request.Render(account, &out, &missing);
+    expected.push_back(out);
+  }
+  vector<std::string_view> all;
+  renderer.RenderAll(&all);
+  assertEq(std::to_string(all.size()), "3");
+  for (std::size_t row = 0; row < all.size(); row++) {
+    assertEq(string(all[row]), expected[row]);
+  }
+  for (std::size_t row = 0; row < accounts.rows(); row++) {
+    assertEq(string(renderer.Render(row)), expected[row]);
+  }
+  try {
+    BatchRenderer(RequestTemplate("$BANKID"), accounts, shared);
+    assertEq("no exception", "Unspecified variable: BANKID");
+  } catch (const string& msg) {
+    assertEq(msg, "Unspecified variable: BANKID");
+  }
+
+  // UIDs from many threads never repeat, and batches get fresh ones per row.
+  vector<string> uids[4];
+  vector<std::thread> threads;
+  for (auto& thread_uids : uids) {
+    threads.emplace_back([&thread_uids] {
+      for (int i = 0; i < 10000; i++) thread_uids.push_back(ofxget::NewOfxUid());
+    });
+  }
+  std::set<string> unique;
+  for (std::size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+    unique.insert(uids[i].begin(), uids[i].end());
+  }
+  assertEq(std::to_string(unique.size()), "40000");
+  assertEq(std::to_string(unique.begin()->size()), "36");
+  shared["TRNUID"] = "shared";
+  BatchRenderer uid_renderer(RequestTemplate("$TRNUID"), accounts, shared);
+  string first(uid_renderer.Render(0));
+  assertEq(first == string(uid_renderer.Render(1)) ? "same" : first.substr(8, 1),
+           "-");
+
+  // Cached dates match strftime across minute boundaries and carry the zone.
+  setenv("TZ", "EST5EDT", 1);
+  tzset();
+  assertEq(ofxget::OfxDate(1524329998, true), "20180421125958.000[-4:EDT]");
+  assertEq(ofxget::OfxDate(1515000000), "20180103122000.000");
+  assertEq(ofxget::OfxDate(1515000001, true), "20180103122001.000[-5:EST]");
+  for (time_t t = 1515000000 - 125; t < 1515000000 + 125; t += 7) {
+    struct tm ltime;
+    localtime_r(&t, &ltime);
+    char expected[32];
+    strftime(expected, sizeof(expected), "%Y%m%d%H%M%S.000", &ltime);
+    assertEq(ofxget::OfxDate(t), expected);
+  }
+  setenv("TZ", "IST-5:30", 1);
+  tzset();
+  assertEq(ofxget::OfxDate(1524329998, true), "20180421222958.000[5.5:IST]");
+
+  // Template files are normalized to CRLF, read once and reread on change.
+  assertEq(ofxget::NormalizeLineEndings("a\nb\r\n\nc"), "a\r\nb\r\n\r\nc\r\n");
+  assertEq(ofxget::NormalizeLineEndings(""), "");
+  const char* template_file = "/tmp/ofxget_test.txt";
+  std::ofstream(template_file) << "<FID>$FID\n";
+  ofxget::TemplateCache cache;
+  RequestTemplate cached = cache.Get(template_file);
+  assertEq(string(cached.text()), "<FID>$FID\r\n");
+  assertEq(cache.Get(template_file).text().data() == cached.text().data() ?
+           "cached" : "reread", "cached");
+  std::ofstream(template_file) << "<ORG>$ORG\n<FID>$FID\n";
+  assertEq(string(cache.Get(template_file).text()),
+           "<ORG>$ORG\r\n<FID>$FID\r\n");
+  remove(template_file);
+  try {
+    cache.Get(template_file);
+    assertEq("no exception", "Could not open");
+  } catch (const string& msg) {
+    assertEq(msg, string("Could not open ") + template_file);
+  }
+
+  // The builder writes the same SGML as the built-in templates, escaped.
+  for (const char* name : {"bank.txt", "investment.txt"}) {
+    VarsMap v;
+    for (int var = 0; var < ofxget::kNumOfxVars; var++) {
+      v[ofxget::OfxVar(var)] = string("v") + std::to_string(var);
+    }
+    BuiltinRequestTemplate(name).Render(v, &rendered, &missing);
+    ofxget::OfxSignon signon;
+    signon.dtclient = v[ofxget::kOfxDateVar];
+    signon.userid = v[ofxget::kUserIdVar];
+    signon.userpass = v[ofxget::kUserPassVar];
+    signon.org = v[ofxget::kOrgVar];
+    signon.fid = v[ofxget::kFidVar];
+    signon.appid = v[ofxget::kAppIdVar];
+    signon.appver = v[ofxget::kAppVerVar];
+    ofxget::OfxAccount account;
+    account.acctid = v[ofxget::kAcctIdVar];
+    account.bankid = v[ofxget::kBankIdVar];
+    account.brokerid = v[ofxget::kBrokerIdVar];
+    account.accttype = "SAVINGS";
+    string built;
+    ofxget::OfxRequestBuilder builder(ofxget::kOfxSgml102, &built);
+    builder.Begin(v[ofxget::kNewFileUidVar]).Signon(signon).ClientCookie("4");
+    if (string(name) == "bank.txt") {
+      builder.BankStatement(v[ofxget::kTrnUidVar], account, "19000101");
+    } else {
+      builder.InvestmentStatement(v[ofxget::kTrnUidVar], account, "19000101",
+                                  v[ofxget::kOfxDateVar]);
+    }
+    builder.End();
+    assertEq(built, rendered);
+  }
+  string xml;
+  ofxget::OfxSignon signon;
+  signon.userpass = "a<b&c";
+  ofxget::OfxRequestBuilder(ofxget::kOfxXml203, &xml)
+      .Begin("").Signon(signon).AccountInfo("1", "19700101")
+      .Profile("2", "19700101").End();
+  assertEq(xml.substr(xml.find("<USERPASS>"), 33),
+           "<USERPASS>a&lt;b&amp;c</USERPASS>");
+  assertEq(xml.find("NEWFILEUID=\"NONE\"") != string::npos &&
+           xml.find("</SIGNUPMSGSRQV1>\r\n<PROFMSGSRQV1>") != string::npos &&
+           xml.substr(xml.size() - 8) == "</OFX>\r\n" ? "" : xml, "");
+
+  assertEq(BuiltinRequestTemplate("badrequest.txt").empty() ? "" : "found", "");
+
+  // Pooled curl handles are shared by URLs on the same origin.
+  using ofxget::UrlOrigin;
+  assertEq(UrlOrigin("https://OFX.Lanxtra.com/ofx/servlet/Teller"),
+           "https://ofx.lanxtra.com:443");
+  assertEq(UrlOrigin("http://user:pw@host:8080?x=1"), "http://host:8080");
+  assertEq(UrlOrigin("https://[::1]:4443/"), "https://[::1]:4443");
+  assertEq(UrlOrigin("ofx.lanxtra.com"), "");
+  ofxget::CurlHandlePool pool;
+  CURL* lanxtra = pool.Acquire("https://ofx.lanxtra.com/a");
+  pool.Release("https://ofx.lanxtra.com/a", lanxtra);
+  CURL* ncr = pool.Acquire("https://ofxdc.prd1.ncr.com/b");
+  CURL* reused = pool.Acquire("https://ofx.lanxtra.com:443/c");
+  assertEq(reused == lanxtra ? "" : "new", "");
+  assertEq(ncr != lanxtra ? "" : "shared", "");
+  for (int i = 0; i < MAX_IDLE_HANDLES_PER_ORIGIN + 2; i++) {
+    pool.Release("https://ofxdc.prd1.ncr.com/b",
+                 i ? curl_easy_init() : ncr);
+  }
+  pool.Release("https://ofx.lanxtra.com/a", lanxtra);
+  assertEq(std::to_string(pool.idle_handles()),
+           std::to_string(MAX_IDLE_HANDLES_PER_ORIGIN + 1));
+  assertEq(std::to_string(pool.stats().reuse_rate()), "0.000000");
+
+  // Every request added to an OfxMulti completes through its callback, also
+  // ones that fail before being sent. Nothing listens on port 1.
+  vector<std::unique_ptr<OfxGetContext>> contexts;
+  ofxget::OfxMulti multi(3, 2);
+  string completed;
+  for (int i = 0; i < 6; i++) {
+    contexts.emplace_back(new OfxGetContext());
+    OfxGetContext& context = *contexts.back();
+    context.vars_map_[ofxget::kUrlVar] =
+        i == 5 ? "http://localhost:1/" : "http://127.0.0.1:1/";
+    context.AddRequestTemplate(string(i == 4 ? "$ACCTID" : "<OFX>"));
+    multi.Add(&context, [&completed, i](OfxGetContext& done) {
+      completed += std::to_string(i) + (done.is_error() ? "" : "ok");
+      if (i == 5) assertEq(done.error_string(), "Curl error: 7");
+    });
+  }
+  multi.Run();
+  std::sort(completed.begin(), completed.end());
+  assertEq(completed, "012345");
+  assertEq(contexts[4]->error_string(), "Unspecified variable: ACCTID");
+  assertEq(std::to_string(multi.queued() + multi.running()), "0");
+
+  // With health checks, requests to servers OFX Home reports as broken start
+  // after working ones, whatever order they were added in.
+  ofxget::InstitutionDirectory::Set(
+      ofxget::InstitutionDirectory::FromInstitutions(
+          ofxget::OfxDumpStringToInstitutions(R"(
+<institution id="901"><ofxfail>1</ofxfail><sslfail>0</sslfail>
+<lastofxvalidation>2020-01-01 00:00:00</lastofxvalidation></institution>
+<institution id="902"><ofxfail>0</ofxfail><sslfail>0</sslfail>
+<lastofxvalidation>2020-01-01 00:00:00</lastofxvalidation></institution>)")));
+  ofxget::OfxMulti serial(1);
+  string started;
+  const char* labels = "BCAD";
+  contexts.clear();
+  for (int i = 0; i < 4; i++) {
+    contexts.emplace_back(new OfxGetContext());
+    OfxGetContext& context = *contexts.back();
+    context.vars_map_[ofxget::kUrlVar] =
+        i % 2 ? "http://localhost:1/" : "http://127.0.0.1:1/";
+    context.AddRequestTemplate(string("<OFX>"));
+    context.institution_id_ = i < 2 ? 901 : 902;
+    context.SkipUnhealthy();
+    char label = labels[i];
+    serial.Add(&context, [&started, label](OfxGetContext& done) {
+      started += label;
+    });
+  }
+  serial.Run();
+  assertEq(started, "ADBC");
+  ofxget::InstitutionDirectory::Set(nullptr);
+
+  // Responses are reserved from Content-Length and written into recycled
+  // buffers.
+  assertEq(std::to_string(ofxget::ContentLength("content-length: 1234\r\n")),
+           "1234");
+  assertEq(std::to_string(ofxget::ContentLength("Content-Type: 12\r\n")), "-1");
+  assertEq(std::to_string(ofxget::ContentLength("Content-Length: x\r\n")),
+           "-1");
+  string body;
+  char header[] = "Content-Length: 5000\r\n";
+  ofxget::CurlReserveContentLength(header, 1, strlen(header), &body);
+  assertEq(body.capacity() >= 5000 ? "" : "small", "");
+  ofxget::ResponseBufferPool buffers;
+  string small = buffers.Take(100), large = buffers.Take(100000);
+  const char* large_data = large.data();
+  buffers.Give(std::move(small));
+  buffers.Give(std::move(large));
+  assertEq(buffers.Take(50000).data() == large_data ? "" : "new", "");
+  assertEq(std::to_string(buffers.ExpectedSize(479)), "0");
+  buffers.RecordSize(479, 8000);
+  assertEq(std::to_string(buffers.ExpectedSize(479)), "9000");
+  // Buffers too small to be worth a slot are dropped.
+  buffers.Give(string(100, 'x'));
+  assertEq(buffers.Take(0).capacity() < 100 ? "" : "pooled", "");
+
+  // PostRequest takes its response buffer from the global pool and
+  // RecycleResponse gives it back, also when the post fails.
+  string pooled = ofxget::ResponseBufferPool::Global().Take(65536);
+  const char* pooled_data = pooled.data();
+  ofxget::ResponseBufferPool::Global().Give(std::move(pooled));
+  {
+    OfxGetContext context;
+    context.vars_map_[ofxget::kUrlVar] = "http://127.0.0.1:1/";
+    context.AddRequestTemplate(string("<OFX>")).PostRequest();
+    assertEq(context.response().data() == pooled_data ? "" : "not pooled",
+             "");
+    context.RecycleResponse();
+    OfxGetContext next;
+    next.vars_map_[ofxget::kUrlVar] = "http://127.0.0.1:1/";
+    next.AddRequestTemplate(string("<OFX>")).PostRequest();
+    assertEq(next.response().data() == pooled_data ? "" : "not reused", "");
+  }
+
+  // Response sinks. A file is only left behind if the transfer completed.
+  const char* response_file = "/tmp/ofxget_test.ofx";
+  {
+    ofxget::FileSink sink(response_file);
+    sink.Begin(4);
+    sink.Write("<OFX", 4);
+    sink.Finish(true);
+  }
+  std::ifstream written(response_file);
+  assertEq(string(std::istreambuf_iterator<char>(written), {}), "<OFX");
+  remove(response_file);
+  {
+    ofxget::FileSink sink(response_file);
+    OfxGetContext context;
+    context.vars_map_[ofxget::kUrlVar] = "http://127.0.0.1:1/";
+    context.AddRequestTemplate(string("<OFX>"))
+        .SetResponseSink(&sink)
+        .PostRequest();
+    assertEq(context.error_string(), "Curl error: 7");
+  }
+  assertEq(std::ifstream(response_file).is_open() ? "exists" : "", "");
+  assertEq(std::ifstream(string(response_file) + ".tmp").is_open()
+               ? "exists" : "", "");
+  // A file that can not be renamed into place is an error.
+  try {
+    ofxget::FileSink sink("/tmp");
+    sink.Finish(true);
+    assertEq("finished", "Could not rename");
+  } catch (const string& msg) {
+    assertEq(msg, "Could not rename /tmp.tmp to /tmp");
+  }
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "ofxhealth.h"
+
+namespace ofxget {
+
+// A failing endpoint is retried at most this often, however many times it
+// failed before.
+#define HEALTH_RETRY_SECONDS (7 * 24 * 3600)
+
+// Days since 1970-01-01 of a proleptic Gregorian date.
+static long DaysFromCivil(int y, int m, int d) {
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// Parse an OFX Home validation time such as "2018-03-18 00:34:54". Returns 0
+// if s is empty or malformed.
+static time_t ParseValidationTime(std::string_view s) {
+  char buf[32];
+  if (s.empty() || s.size() >= sizeof(buf)) return 0;
+  s.copy(buf, s.size());
+  buf[s.size()] = '\0';
+  int y, mo, d, h, mi, sec;
+  if (sscanf(buf, "%d-%d-%d %d:%d:%d", &y, &mo, &d, &h, &mi, &sec) != 6) {
+    return 0;
+  }
+  return DaysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + sec;
+}
+
+double HealthScore(const InstitutionView& inst, const EndpointHistory* history,
+                   time_t now) {
+  // OFX Home reports ofxfail 0 when the server answered a test request, 1
+  // when it did not and other values when it could not be tested. A failure
+  // checked in the last four years scores below DEFAULT_MIN_HEALTH, so the
+  // server is skipped without a request. Older ones decay towards 0.5 below
+  // and are tried again.
+  double score;
+  switch (inst.ofxfail()) {
+    case 0: score = 1.0; break;
+    case 1: score = 0.0; break;
+    default: score = 0.6; break;
+  }
+  if (inst.sslfail() != 0) {
+    score *= 0.5;
+  }
+
+  // Old validations are weak evidence either way, so pull them towards a
+  // neutral 0.5. Results more than ten years old keep 30% of their weight.
+  time_t checked = std::max(ParseValidationTime(inst.lastofxvalidation()),
+                            ParseValidationTime(inst.lastsslvalidation()));
+  double years = checked ? (now - checked) / (365.25 * 86400) : 10;
+  double weight = std::max(0.3, 1 - std::max(0.0, years) / 10);
+  score = 0.5 + (score - 0.5) * weight;
+
+  if (!history) {
+    return score;
+  }
+  if (history->consecutive_failures == 0) {
+    return history->successes > 0 ? std::max(score, 0.9) : score;
+  }
+  // Each consecutive failure halves the score, but once a failure is old
+  // enough the endpoint gets a single retry.
+  int failures = history->consecutive_failures;
+  if (now - history->last_failure > HEALTH_RETRY_SECONDS) {
+    failures = 1;
+  }
+  score = std::min(score, 0.6);
+  for (int i = 1; i < failures && score > 0.01; i++) {
+    score *= 0.5;
+  }
+  return score;
+}
+
+EndpointHealth& EndpointHealth::Global() {
+  static EndpointHealth health;
+  return health;
+}
+
+void EndpointHealth::Load(const string& filename) {
+  std::ifstream f(filename);
+  if (!f.is_open()) {
+    return;
+  }
+  map<int, EndpointHistory> loaded;
+  string line;
+  while (std::getline(f, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream fields(line);
+    int id;
+    EndpointHistory h;
+    long long last_success, last_failure;
+    if (!(fields >> id >> h.successes >> h.failures >> h.consecutive_failures
+                 >> last_success >> last_failure)) {
+      throw "Could not parse " + filename + ": " + line;
+    }
+    h.last_success = last_success;
+    h.last_failure = last_failure;
+    loaded[id] = h;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  history_.swap(loaded);
+}
+
+void EndpointHealth::Save(const string& filename) const {
+  string tmp = filename + ".tmp";
+  {
+    std::ofstream f(tmp, std::ios::trunc);
+    if (!f.is_open()) {
+      throw "Could not open " + tmp;
+    }
+    f << "# id successes failures consecutive_failures last_success "
+         "last_failure" << std::endl;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& h : history_) {
+      f << h.first << " " << h.second.successes << " " << h.second.failures
+        << " " << h.second.consecutive_failures << " "
+        << (long long) h.second.last_success << " "
+        << (long long) h.second.last_failure << std::endl;
+    }
+    if (!f) {
+      throw "Could not write " + tmp;
+    }
+  }
+  if (rename(tmp.c_str(), filename.c_str()) != 0) {
+    remove(tmp.c_str());
+    throw "Could not rename " + tmp + " to " + filename;
+  }
+}
+
+void EndpointHealth::RecordSuccess(int id, time_t now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  EndpointHistory& h = history_[id];
+  h.successes++;
+  h.consecutive_failures = 0;
+  h.last_success = now;
+}
+
+void EndpointHealth::RecordFailure(int id, time_t now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  EndpointHistory& h = history_[id];
+  h.failures++;
+  h.consecutive_failures++;
+  h.last_failure = now;
+}
+
+bool EndpointHealth::Get(int id, EndpointHistory* history) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = history_.find(id);
+  if (it == history_.end()) {
+    return false;
+  }
+  *history = it->second;
+  return true;
+}
+
+double EndpointHealth::Score(int id, time_t now) const {
+  std::shared_ptr<const InstitutionDirectory> dir = InstitutionDirectory::Get();
+  const DirRecord* r = dir->FindById(id);
+  if (!r) {
+    return 0;
+  }
+  EndpointHistory history;
+  bool has_history = Get(id, &history);
+  return HealthScore(dir->view(*r), has_history ? &history : nullptr, now);
+}
+
+void EndpointHealth::SortByHealth(vector<int>* ids, time_t now) const {
+  vector<std::pair<double, int>> scored;
+  for (int id : *ids) {
+    scored.emplace_back(-Score(id, now), id);
+  }
+  std::stable_sort(scored.begin(), scored.end(),
+                   [](const std::pair<double, int>& a,
+                      const std::pair<double, int>& b) {
+                     return a.first < b.first;
+                   });
+  for (std::size_t i = 0; i < scored.size(); i++) {
+    (*ids)[i] = scored[i].second;
+  }
+}
+
+}  // namespace ofxget
@@ -0,0 +1,74 @@
+#ifndef OFXHEALTH_H
+#define OFXHEALTH_H
+
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ofxdirectory.h"
+
+namespace ofxget {
+
+// Endpoint health lets batch runs skip or deprioritize institutions whose OFX
+// servers are known to be broken instead of waiting REQUEST_TIMEOUT seconds on
+// each of them. A score in [0, 1] is derived from the OFX Home validation
+// fields (ofxfail, sslfail and how recently they were checked) and from the
+// outcomes of our own requests, which take precedence once there are any.
+
+// Below this score PostRequest skips an institution when health checks are
+// enabled with OfxGetContext::SkipUnhealthy.
+#define DEFAULT_MIN_HEALTH 0.2
+
+// Locally recorded request outcomes for one institution.
+struct EndpointHistory {
+  int successes = 0;
+  int failures = 0;
+  // Failures since the last success.
+  int consecutive_failures = 0;
+  time_t last_success = 0;
+  time_t last_failure = 0;
+};
+
+// Score an institution from its OFX Home fields and, if not null, local
+// history. now is the current time.
+double HealthScore(const InstitutionView& inst, const EndpointHistory* history,
+                   time_t now);
+
+// Thread safe store of request outcomes keyed by OFX Home id. Global()
+// returns the store used by OfxGetContext.
+class EndpointHealth {
+ public:
+  static EndpointHealth& Global();
+
+  // Read history saved by Save. A missing file is not an error. Throws a
+  // string if the file can not be parsed.
+  void Load(const string& filename);
+
+  // Write the history to filename, replacing it atomically. Throws a string
+  // on error.
+  void Save(const string& filename) const;
+
+  void RecordSuccess(int id, time_t now);
+  void RecordFailure(int id, time_t now);
+
+  // Returns false if nothing has been recorded for id.
+  bool Get(int id, EndpointHistory* history) const;
+
+  // Health score of an institution in the shared InstitutionDirectory. Ids
+  // that are not in the directory score 0.
+  double Score(int id, time_t now) const;
+
+  // Stable sort ids healthiest first so batch runs reach working servers
+  // before broken ones.
+  void SortByHealth(vector<int>* ids, time_t now) const;
+
+ private:
+  mutable std::mutex mutex_;
+  map<int, EndpointHistory> history_;
+};
+
+}  // namespace ofxget
+
+#endif // OFXHEALTH_H
@@ -1,10 +1,17 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <regex>
 #include <curl/curl.h>
+#include <strings.h>
 
 #include "pugixml/pugixml.hpp"
 
 #include "ofxhome.h"
+#include "ofxhttp.h"
 
 using ofxget::Institution;
 using std::cout;
@@ -14,17 +21,15 @@ using std::string;
 
 namespace ofxget {
 
+#define OFXHOME_DUMP_URL "http://www.ofxhome.com/api.php?dump=yes"
+
 static size_t CurlWriteToString(char *ptr, size_t size, size_t nmemb, void *userdata) {
   if (size != 1) {
     char err[255];
     sprintf(err, "In response, expected char size 1, got %ld", size);
     throw string(err);
   }
-  string* out = static_cast<string*>(userdata);
-  string to_add;
-  to_add.resize(nmemb);
-  memcpy((void*) to_add.c_str(), (void*) ptr, nmemb);
-  *out += to_add;
+  static_cast<string*>(userdata)->append(ptr, nmemb);
   return size * nmemb;
 }
 
@@ -68,24 +73,263 @@ string OfxHomeFullDumpString() {
 
 )RESPONSE";
     }
-    CURL *curl = curl_easy_init();
+    CURL *curl = NewCurlHandle();
     if (! curl) {
       throw string("Could not initialize curl");
     }
 
     string response;
-    curl_easy_setopt(curl, CURLOPT_URL, "http://www.ofxhome.com/api.php?dump=yes");
+    curl_easy_setopt(curl, CURLOPT_URL, OFXHOME_DUMP_URL);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlWriteToString);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, CurlReserveContentLength);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&response);
 
     CURLcode res = curl_easy_perform(curl);
+    curl_easy_cleanup(curl);
     if (res != CURLE_OK) {
         throw "Curl error: " + std::to_string(res);
     }
 
+    return response;
+}
+
+static bool SameInstitution(const Institution& a, const Institution& b) {
+  return a.name == b.name && a.fid == b.fid && a.org == b.org &&
+         a.url == b.url && a.ofxfail == b.ofxfail && a.sslfail == b.sslfail &&
+         a.lastofxvalidation == b.lastofxvalidation &&
+         a.lastsslvalidation == b.lastsslvalidation &&
+         a.brokerid == b.brokerid && a.bankid == b.bankid &&
+         a.profile == b.profile;
+}
+
+InstitutionDelta DiffInstitutions(const vector<Institution>& before,
+                                  const vector<Institution>& after) {
+  map<int, const Institution*> old_by_id;
+  for (const Institution& i : before) {
+    old_by_id[i.ofxhome_id] = &i;
+  }
+  InstitutionDelta delta;
+  for (const Institution& i : after) {
+    auto it = old_by_id.find(i.ofxhome_id);
+    if (it == old_by_id.end()) {
+      delta.added.push_back(i.ofxhome_id);
+      continue;
+    }
+    if (!SameInstitution(*it->second, i)) {
+      delta.changed.push_back(i.ofxhome_id);
+    }
+    old_by_id.erase(it);
+  }
+  for (const auto& removed : old_by_id) {
+    delta.removed.push_back(removed.first);
+  }
+  std::sort(delta.added.begin(), delta.added.end());
+  std::sort(delta.changed.begin(), delta.changed.end());
+  return delta;
+}
+
+struct RefreshState {
+  std::ofstream* out;
+  InstitutionStreamParser* parser;
+  string etag;
+  string last_modified;
+  string error;
+  // Status of the latest response. Only a 200 body is the dump.
+  long http_code;
+};
+
+// Value of header if line is "header: value", otherwise empty.
+static string HeaderValue(const string& line, const string& header) {
+  if (line.size() <= header.size() + 1 || line[header.size()] != ':' ||
+      strncasecmp(line.c_str(), header.c_str(), header.size()) != 0) {
+    return "";
+  }
+  size_t begin = line.find_first_not_of(" \t", header.size() + 1);
+  size_t end = line.find_last_not_of(" \t\r\n");
+  if (begin == string::npos || end < begin) return "";
+  return line.substr(begin, end - begin + 1);
+}
+
+static size_t RefreshHeaderCallback(char *buffer, size_t size, size_t nitems,
+                                    void *userdata) {
+  RefreshState* state = static_cast<RefreshState*>(userdata);
+  string line(buffer, size * nitems);
+  if (line.compare(0, 5, "HTTP/") == 0) {
+    // A new response, eg after a redirect. Forget the previous validators.
+    state->etag.clear();
+    state->last_modified.clear();
+    size_t code = line.find(' ');
+    state->http_code =
+        code == string::npos ? 0 : strtol(line.c_str() + code, nullptr, 10);
+  }
+  string value = HeaderValue(line, "ETag");
+  if (!value.empty()) state->etag = value;
+  value = HeaderValue(line, "Last-Modified");
+  if (!value.empty()) state->last_modified = value;
+  return size * nitems;
+}
+
+static size_t RefreshWriteCallback(char *ptr, size_t size, size_t nmemb,
+                                   void *userdata) {
+  RefreshState* state = static_cast<RefreshState*>(userdata);
+  if (state->http_code != 200) {
+    // An error page or a redirect body, not the dump.
+    return size * nmemb;
+  }
+  try {
+    state->out->write(ptr, size * nmemb);
+    if (!*state->out) {
+      throw string("Could not write institutions");
+    }
+    state->parser->Feed(ptr, size * nmemb);
+  } catch (const string& msg) {
+    state->error = msg;
+    return 0;
+  }
+  return size * nmemb;
+}
+
+// Parse the institutions in a dump file with InstitutionStreamParser. A
+// missing file has none.
+static vector<Institution> ReadInstitutionsFile(const string& filename) {
+  vector<Institution> insts;
+  std::ifstream f(filename.c_str(), std::ios::binary);
+  if (!f.is_open()) return insts;
+  InstitutionStreamParser parser(
+      [&insts](const Institution& i) { insts.push_back(i); });
+  char buffer[64 * 1024];
+  while (f.read(buffer, sizeof(buffer)) || f.gcount() > 0) {
+    parser.Feed(buffer, f.gcount());
+  }
+  parser.Finish();
+  return insts;
+}
+
+// Write the validators of a refreshed dump to filename, replacing it
+// atomically. Throws a string on error.
+static void WriteValidators(const string& filename, const string& etag,
+                            const string& last_modified) {
+  string tmp = filename + ".tmp";
+  {
+    std::ofstream v(tmp.c_str(), std::ios::trunc);
+    if (!etag.empty()) v << "ETag: " << etag << endl;
+    if (!last_modified.empty()) v << "Last-Modified: " << last_modified << endl;
+    v.close();
+    if (!v) {
+      remove(tmp.c_str());
+      throw "Could not write " + tmp;
+    }
+  }
+  if (rename(tmp.c_str(), filename.c_str()) != 0) {
+    remove(tmp.c_str());
+    throw "Could not rename " + tmp + " to " + filename;
+  }
+}
+
+bool OfxHomeRefresh(const string& filename, vector<Institution>* institutions,
+                    vector<Institution>* previous) {
+  string validators_file = filename + ".validators";
+  string etag, last_modified;
+  {
+    std::ifstream f(filename.c_str());
+    std::ifstream v(validators_file.c_str());
+    string line;
+    // Validators are only meaningful while the file they describe exists.
+    while (f.is_open() && std::getline(v, line)) {
+      if (!HeaderValue(line, "ETag").empty()) {
+        etag = HeaderValue(line, "ETag");
+      } else if (!HeaderValue(line, "Last-Modified").empty()) {
+        last_modified = HeaderValue(line, "Last-Modified");
+      }
+    }
+  }
+
+  CURL *curl = NewCurlHandle();
+  if (! curl) {
+    throw string("Could not initialize curl");
+  }
+  struct curl_slist *headerlist = NULL;
+  if (!etag.empty()) {
+    headerlist = curl_slist_append(headerlist,
+                                   ("If-None-Match: " + etag).c_str());
+  }
+  if (!last_modified.empty()) {
+    headerlist = curl_slist_append(
+        headerlist, ("If-Modified-Since: " + last_modified).c_str());
+  }
+
+  string tmp = filename + ".tmp";
+  std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    curl_slist_free_all(headerlist);
     curl_easy_cleanup(curl);
+    throw "Could not open " + tmp;
+  }
+  vector<Institution> parsed;
+  InstitutionStreamParser parser(
+      [&parsed](const Institution& i) { parsed.push_back(i); });
+  RefreshState state{&out, &parser, "", "", "", 0};
 
-    return response;
+  curl_easy_setopt(curl, CURLOPT_URL, OFXHOME_DUMP_URL);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerlist);
+  // An empty string offers every encoding curl can decode, eg gzip.
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, RefreshWriteCallback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&state);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, RefreshHeaderCallback);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&state);
+
+  CURLcode res = curl_easy_perform(curl);
+  long http_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+  curl_slist_free_all(headerlist);
+  curl_easy_cleanup(curl);
+  out.close();
+
+  try {
+    if (!state.error.empty()) {
+      throw state.error;
+    }
+    if (res != CURLE_OK) {
+      throw "Curl error: " + std::to_string(res);
+    }
+    if (http_code == 304) {
+      remove(tmp.c_str());
+      return false;
+    }
+    if (http_code != 200) {
+      throw "OFX Home returned HTTP " + std::to_string(http_code);
+    }
+    parser.Finish();
+    if (parsed.empty()) {
+      throw string("No institutions in OFX Home dump");
+    }
+    if (previous) {
+      *previous = ReadInstitutionsFile(filename);
+    }
+  } catch (const string&) {
+    remove(tmp.c_str());
+    throw;
+  }
+
+  if (rename(tmp.c_str(), filename.c_str()) != 0) {
+    remove(tmp.c_str());
+    throw "Could not rename " + tmp + " to " + filename;
+  }
+  try {
+    WriteValidators(validators_file, state.etag, state.last_modified);
+  } catch (const string&) {
+    // The old validators describe the old dump. Without any, the next
+    // refresh downloads unconditionally.
+    remove(validators_file.c_str());
+    throw;
+  }
+  if (institutions) {
+    institutions->swap(parsed);
+  }
+  return true;
 }
 
 std::ostream& operator<<(std::ostream& stream,
@@ -111,6 +355,27 @@ std::ostream& operator<<(std::ostream& stream,
   return stream;
 }
 
+static Institution NodeToInstitution(const pugi::xml_node& inst) {
+  Institution i;
+  i.ofxhome_id = inst.attribute("id").as_int();
+  i.name = inst.child("name").child_value();
+  i.url = inst.child("url").child_value();
+  i.fid = inst.child("fid").child_value();
+  i.org = inst.child("org").child_value();
+  i.brokerid = inst.child("brokerid").child_value();
+  i.bankid = inst.child("bankid").child_value();
+  i.ofxfail = inst.child("ofxfail").text().as_int();
+  i.sslfail = inst.child("sslfail").text().as_int();
+  i.lastofxvalidation = inst.child("lastofxvalidation").child_value();
+  i.lastsslvalidation = inst.child("lastsslvalidation").child_value();
+  auto profile = inst.child("profile");
+  for (pugi::xml_attribute_iterator ait = profile.attributes_begin(); ait != profile.attributes_end(); ++ait)
+  {
+    i.profile[ait->name()] = ait->value();
+  }
+  return i;
+}
+
 vector<Institution> OfxDumpStringToInstitutions(const string& dump) {
   pugi::xml_document doc;
   pugi::xml_parse_result result = doc.load_string(dump.c_str());
@@ -120,29 +385,109 @@ vector<Institution> OfxDumpStringToInstitutions(const string& dump) {
 
   vector<Institution> insts;
   for (pugi::xml_node inst = doc.child("institution"); inst; inst = inst.next_sibling("institution")) {
-    Institution i;
-    i.ofxhome_id = inst.attribute("id").as_int();
-    i.name = inst.child("name").child_value();
-    i.url = inst.child("url").child_value();
-    i.fid = inst.child("fid").child_value();
-    i.org = inst.child("org").child_value();
-    i.brokerid = inst.child("brokerid").child_value();
-    i.bankid = inst.child("bankid").child_value();
-    i.ofxfail = inst.child("ofxfail").text().as_int();
-    i.sslfail = inst.child("sslfail").text().as_int();
-    i.lastofxvalidation = inst.child("lastofxvalidation").child_value();
-    i.lastsslvalidation = inst.child("lastsslvalidation").child_value();
-    auto profile = inst.child("profile");
-    for (pugi::xml_attribute_iterator ait = profile.attributes_begin(); ait != profile.attributes_end(); ++ait)
-    {
-      i.profile[ait->name()] = ait->value();
-    }
-    insts.push_back(i);
+    insts.push_back(NodeToInstitution(inst));
   }
 
   return insts;
 }
 
+static const char kOpenTag[] = "<institution";
+static const char kCloseTag[] = "</institution>";
+
+InstitutionStreamParser::InstitutionStreamParser(
+    std::function<void(const Institution&)> on_institution)
+    : on_institution_(std::move(on_institution)),
+      in_record_(false),
+      scan_pos_(0) {}
+
+void InstitutionStreamParser::Feed(const char* data, size_t size) {
+  buffer_.append(data, size);
+  for (;;) {
+    if (!in_record_) {
+      size_t begin = buffer_.find(kOpenTag);
+      if (begin == string::npos) {
+        // Keep just enough to match a tag split across chunks.
+        size_t keep = sizeof(kOpenTag) - 2;
+        if (buffer_.size() > keep) {
+          buffer_.erase(0, buffer_.size() - keep);
+        }
+        return;
+      }
+      buffer_.erase(0, begin);
+      in_record_ = true;
+      scan_pos_ = 0;
+    }
+    size_t end = buffer_.find(kCloseTag, scan_pos_);
+    if (end == string::npos) {
+      size_t back = sizeof(kCloseTag) - 2;
+      scan_pos_ = buffer_.size() > back ? buffer_.size() - back : 0;
+      return;
+    }
+    end += sizeof(kCloseTag) - 1;
+    pugi::xml_document doc;
+    if (!doc.load_buffer(buffer_.data(), end)) {
+      throw "Could not parse institution " + buffer_.substr(0, 40);
+    }
+    on_institution_(NodeToInstitution(doc.child("institution")));
+    buffer_.erase(0, end);
+    in_record_ = false;
+  }
+}
+
+void InstitutionStreamParser::Finish() {
+  if (in_record_) {
+    throw string("Institutions ended inside a record");
+  }
+  buffer_.clear();
+}
+
+struct StreamState {
+  InstitutionStreamParser* parser;
+  std::ostream* raw;
+  string error;
+};
+
+static size_t CurlWriteToParser(char *ptr, size_t size, size_t nmemb,
+                                void *userdata) {
+  StreamState* state = static_cast<StreamState*>(userdata);
+  try {
+    if (state->raw) {
+      state->raw->write(ptr, size * nmemb);
+    }
+    state->parser->Feed(ptr, size * nmemb);
+  } catch (const string& msg) {
+    // Exceptions must not unwind through curl. Abort the transfer instead.
+    state->error = msg;
+    return 0;
+  }
+  return size * nmemb;
+}
+
+void OfxHomeStreamInstitutions(
+    const std::function<void(const Institution&)>& on_institution,
+    std::ostream* raw) {
+  CURL *curl = NewCurlHandle();
+  if (! curl) {
+    throw string("Could not initialize curl");
+  }
+
+  InstitutionStreamParser parser(on_institution);
+  StreamState state{&parser, raw, ""};
+  curl_easy_setopt(curl, CURLOPT_URL, OFXHOME_DUMP_URL);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlWriteToParser);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&state);
+
+  CURLcode res = curl_easy_perform(curl);
+  curl_easy_cleanup(curl);
+  if (!state.error.empty()) {
+    throw state.error;
+  }
+  if (res != CURLE_OK) {
+    throw "Curl error: " + std::to_string(res);
+  }
+  parser.Finish();
+}
+
 const Institution* FindInstitutionByName(
     const vector<Institution>& institutions,
     const string& name)
@@ -167,7 +512,7 @@ string AnonymizeRequest(const string& request) {
 }
 
 string UploadSuccessfulRequest(const string& api_key, const string& url, const string& request) {
-    CURL *curl = curl_easy_init();
+    CURL *curl = NewCurlHandle();
     if (! curl) {
       throw string("Could not initialize curl");
     }
@@ -177,6 +522,10 @@ string UploadSuccessfulRequest(const string& api_key, const string& url, const s
     char *request_output = curl_easy_escape(curl, anonymized_request.c_str(), anonymized_request.size());
     char *url_output = curl_easy_escape(curl, url.c_str(), url.size());
     if (!api_key_output || !request_output || !url_output) {
+      curl_free(api_key_output);
+      curl_free(request_output);
+      curl_free(url_output);
+      curl_easy_cleanup(curl);
       throw string("Could not curl_easy_escape request");
     }
     string output = string("api_key=") + api_key_output + "&url=" + url_output + "&request=" + request_output;
@@ -192,25 +541,29 @@ string UploadSuccessfulRequest(const string& api_key, const string& url, const s
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, output.c_str());
 
     CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        throw "Curl error: " + std::to_string(res);
-    }
-
     curl_free(api_key_output);
     curl_free(request_output);
+    curl_free(url_output);
     curl_easy_cleanup(curl);
+    if (res != CURLE_OK) {
+        throw "Curl error: " + std::to_string(res);
+    }
 
     return response;
 }
 
 // Returns true if the api_key is avalid.
 bool ValidateApiKey(const string& api_key) {
-    CURL *curl = curl_easy_init();
+    CURL *curl = NewCurlHandle();
     if (! curl) {
       throw string("Could not initialize curl");
     }
 
     char *api_key_output = curl_easy_escape(curl, api_key.c_str(), api_key.size());
+    if (!api_key_output) {
+      curl_easy_cleanup(curl);
+      throw string("Could not curl_easy_escape api key");
+    }
     string output = string("api_key=") + api_key_output;
     string response;
 #ifdef OFXHOME_DEBUG
@@ -224,13 +577,12 @@ bool ValidateApiKey(const string& api_key) {
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, output.c_str());
 
     CURLcode res = curl_easy_perform(curl);
+    curl_free(api_key_output);
+    curl_easy_cleanup(curl);
     if (res != CURLE_OK) {
         throw "Curl error: " + std::to_string(res);
     }
 
-    curl_free(api_key_output);
-    curl_easy_cleanup(curl);
-
     return response == "success";
 }
 
@@ -1,6 +1,7 @@
 #ifndef OFXHOME_H
 #define OFXHOME_H
 
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
@@ -31,8 +32,63 @@ struct Institution {
 
 string OfxHomeFullDumpString();
 
+// Incremental parser for the OFX Home dump. Bytes may be fed in chunks of any
+// size, eg straight from a curl write callback. Each institution is passed to
+// the callback as soon as its closing </institution> tag arrives, so only the
+// record being parsed is buffered, never the whole dump.
+class InstitutionStreamParser {
+ public:
+  explicit InstitutionStreamParser(
+      std::function<void(const Institution&)> on_institution);
+
+  // Parse the next chunk of the dump. Throws a string on malformed records.
+  void Feed(const char* data, size_t size);
+
+  // Call after the last chunk. Throws a string if the dump ended in the
+  // middle of a record.
+  void Finish();
+
+ private:
+  std::function<void(const Institution&)> on_institution_;
+  // The current record if in_record_, otherwise a short tail that may hold
+  // the start of the next <institution tag.
+  string buffer_;
+  bool in_record_;
+  // Where to resume looking for the closing tag in buffer_.
+  size_t scan_pos_;
+};
+
+// Download the OFX Home dump and parse it as it arrives, calling
+// on_institution for each institution. If raw is not null the downloaded
+// bytes are also written to it. Throws a string on error.
+void OfxHomeStreamInstitutions(
+    const std::function<void(const Institution&)>& on_institution,
+    std::ostream* raw = nullptr);
+
 vector<Institution> OfxDumpStringToInstitutions(const string& dump);
 
+// Changes between two institution lists, by OFX Home id.
+struct InstitutionDelta {
+  vector<int> added;
+  vector<int> removed;
+  vector<int> changed;
+};
+
+InstitutionDelta DiffInstitutions(const vector<Institution>& before,
+                                  const vector<Institution>& after);
+
+// Refresh filename with the OFX Home dump if it changed since the last
+// refresh. The request is conditional on the ETag and Last-Modified
+// validators kept in filename + ".validators", and accepts a compressed
+// response. A new dump is streamed to a temporary file that atomically
+// replaces filename, and its institutions are stored in institutions if not
+// null. If previous is not null, it is set to the institutions filename held
+// before it was replaced; the old file is only read when a new dump arrived.
+// Returns false if the dump was not modified. Throws a string on error,
+// naming the HTTP status if OFX Home answered with anything but 200 or 304.
+bool OfxHomeRefresh(const string& filename, vector<Institution>* institutions,
+                    vector<Institution>* previous = nullptr);
+
 const Institution* FindInstitutionByName(
     const vector<Institution>& institutions,
     const string& name);
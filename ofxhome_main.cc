@@ -1,23 +1,121 @@
 #include <iostream>
 
+#include "clap/include/cmdarg.hh"
+#include "clap/include/cmdline.hh"
+
+#include "ofxdirectory.h"
 #include "ofxhome.h"
 
+using ofxget::CompileInstitutionFiles;
+using ofxget::DiffInstitutions;
+using ofxget::DirectoryImage;
 using ofxget::Institution;
-using ofxget::OfxHomeFullDumpString;
-using ofxget::OfxDumpStringToInstitutions;
+using ofxget::InstitutionDirectory;
+using ofxget::InstitutionDelta;
+using ofxget::InstitutionMatch;
+using ofxget::OfxHomeRefresh;
+using ofxget::OfxHomeStreamInstitutions;
+using ofxget::WriteCompiledInstitutions;
 using std::cout;
 using std::endl;
 
-int main() {
+// Compile an institutions.txt dump, with local overrides applied, into the
+// binary directory read by OfxGetContext::AddInstitution.
+static void Compile(const string& input, const string& overrides,
+                    const string& output) {
+  // InstitutionDirectory::Load recompiles institutions.dir from the default
+  // files whenever it was compiled from anything else, so it would be lost.
+  if (output == INSTITUTIONS_DIR_FILE &&
+      (input != INSTITUTIONS_FILE || overrides != INSTITUTIONS_OVERRIDES_FILE)) {
+    throw string(INSTITUTIONS_DIR_FILE " is always compiled from "
+                 INSTITUTIONS_FILE " and " INSTITUTIONS_OVERRIDES_FILE
+                 ". Pass -output to compile other files.");
+  }
+  string image = CompileInstitutionFiles(input, overrides);
+  WriteCompiledInstitutions(image, output);
+  cout << "Compiled "
+       << DirectoryImage::FromString(std::move(image))->record_count()
+       << " institutions into " << output << endl;
+}
+
+// Print one line per institution id in ids, prefixed by marker.
+static void PrintIds(const string& marker, const vector<int>& ids,
+                     const vector<Institution>& insts) {
+  map<int, const Institution*> by_id;
+  for (const Institution& i : insts) {
+    by_id[i.ofxhome_id] = &i;
+  }
+  for (int id : ids) {
+    cout << marker << " " << id << "\t" << by_id[id]->name << endl;
+  }
+}
+
+// Refresh filename from OFX Home if it changed, and print what changed.
+static void Refresh(const string& filename) {
+  vector<Institution> before, after;
+  if (!OfxHomeRefresh(filename, &after, &before)) {
+    cout << filename << " is up to date" << endl;
+    return;
+  }
+  InstitutionDelta delta = DiffInstitutions(before, after);
+  cout << "Refreshed " << filename << ": " << delta.added.size()
+       << " added, " << delta.removed.size() << " removed, "
+       << delta.changed.size() << " changed" << endl;
+  PrintIds("+", delta.added, after);
+  PrintIds("-", delta.removed, before);
+  PrintIds("~", delta.changed, after);
+}
+
+// Print the institutions best matching name from the shared directory.
+static int Find(const string& name) {
+  std::shared_ptr<const InstitutionDirectory> dir = InstitutionDirectory::Get();
+  vector<InstitutionMatch> matches = dir->Search(name, 10);
+  if (matches.empty()) {
+    cout << "No institution matches " << name << endl;
+    return 1;
+  }
+  for (const InstitutionMatch& m : matches) {
+    cout << m.record->ofxhome_id << "\t" << dir->str(m.record->name) << endl;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  CmdArgBool compile('c', "compile", "Compile an institutions file into the binary directory used by ofxget instead of downloading from OFX Home.", CmdArg::isOPT | CmdArg::isVALOPT);
+  CmdArgStr input('i', "input", "input_file", "File to compile. Defaults to " INSTITUTIONS_FILE ". Other files need -output.", CmdArg::isOPT);
+  CmdArgStr overrides('v', "overrides", "overrides_file", "Local overrides applied on top of the compiled file. Defaults to " INSTITUTIONS_OVERRIDES_FILE ".", CmdArg::isOPT);
+  CmdArgBool refresh('r', "refresh", "Download the OFX Home dump only if it changed since the last refresh, and print the institutions that changed.", CmdArg::isOPT | CmdArg::isVALOPT);
+  CmdArgStr output('o', "output", "output_file", "File to write. Defaults to " INSTITUTIONS_DIR_FILE " with -compile and " INSTITUTIONS_FILE " with -refresh.", CmdArg::isOPT);
+  CmdArgStr name('n', "name", "name", "Print the ids of the institutions best matching name instead of downloading from OFX Home.", CmdArg::isOPT);
+  CmdLine cmd(argv[0], &compile, &input, &overrides, &refresh, &output, &name, nullptr);
+  cmd.parse(argc, argv);
+
   try {
-    string dump = OfxHomeFullDumpString();
-    cout << dump << endl;
-    vector<Institution> insts = OfxDumpStringToInstitutions(dump);
-    //for (const auto& i : insts) {
-    //  cout << i << endl;
-    //}
+    if (compile) {
+      Compile(input.isFound() ? string(input) : INSTITUTIONS_FILE,
+              overrides.isFound() ? string(overrides)
+                                  : INSTITUTIONS_OVERRIDES_FILE,
+              output.isFound() ? string(output) : INSTITUTIONS_DIR_FILE);
+      return 0;
+    }
+    if (refresh) {
+      Refresh(output.isFound() ? string(output) : INSTITUTIONS_FILE);
+      return 0;
+    }
+    if (name.isFound()) {
+      return Find(string(name));
+    }
+    // Stream the dump to stdout, parsing each record as it arrives.
+    std::size_t count = 0;
+    OfxHomeStreamInstitutions([&count](const Institution&) { count++; },
+                              &cout);
+    cout << endl;
+    if (count == 0) {
+      throw string("No institutions in OFX Home dump");
+    }
   } catch(const string& msg) {
     cout << msg << endl;
+    return 1;
   }
 
   return 0;
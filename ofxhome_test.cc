@@ -1,8 +1,52 @@
+#include <cstddef>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <thread>
 
+#include "ofxdirectory.h"
+#include "ofxhealth.h"
 #include "ofxhome.h"
 
 using ofxget::AnonymizeRequest;
+using ofxget::CompileInstitutionFiles;
+using ofxget::CompileInstitutions;
+using ofxget::DirHeader;
+using ofxget::DirRecord;
+using ofxget::DirectoryImage;
+using ofxget::EndpointHealth;
+using ofxget::EndpointHistory;
+using ofxget::HealthScore;
+using ofxget::InstitutionDirectory;
+using ofxget::InstitutionStreamParser;
+using ofxget::Institution;
+using ofxget::OfxDumpStringToInstitutions;
+using ofxget::WriteCompiledInstitutions;
+
+const char* kDump = R"DUMP(<?xml version="1.0" encoding="utf-8"?>
+<institution id="479">
+<name>Vanguard Group, The</name>
+<fid>15103</fid>
+<org>Vanguard</org>
+<brokerid>vanguard.com</brokerid>
+<url>https://vesnc.vanguard.com/us/OfxDirectConnectServlet</url>
+<ofxfail>0</ofxfail>
+<sslfail>0</sslfail>
+<lastofxvalidation>2018-03-18 00:34:54</lastofxvalidation>
+<lastsslvalidation>2018-03-18 00:34:54</lastsslvalidation>
+<profile finame="Vanguard" city="Valley Forge" signonmsgset="true" invstmtmsgset="true"/>
+</institution>
+<institution id="422">
+<name>Safe Credit Union - OFX Beta</name>
+<fid>321173742</fid>
+<org>DI</org>
+<url>https://ofxcert.diginsite.com/cmr/cmr.ofx</url>
+<ofxfail>3</ofxfail>
+<sslfail>0</sslfail>
+<lastofxvalidation>2010-03-18 16:25:00</lastofxvalidation>
+<lastsslvalidation>2020-03-15 01:00:06</lastsslvalidation>
+</institution>
+)DUMP";
 
 void assertEq(const string& actual, const string& expected) {
   if (actual != expected) {
@@ -17,5 +61,228 @@ int main() {
   assertEq(AnonymizeRequest("<USERID>123<USERID>456"), "<USERID>X\n<USERID>X\n");
   assertEq(AnonymizeRequest("<ACCTID>123"), "<ACCTID>X\n");
   assertEq(AnonymizeRequest("<USERPASS>123"), "<USERPASS>X\n");
+
+  // Records split across chunks of every size parse the same as the DOM.
+  for (size_t chunk = 1; chunk < 64; chunk++) {
+    vector<Institution> streamed;
+    InstitutionStreamParser parser(
+        [&streamed](const Institution& i) { streamed.push_back(i); });
+    string dump = kDump;
+    for (size_t i = 0; i < dump.size(); i += chunk) {
+      parser.Feed(dump.data() + i, std::min(chunk, dump.size() - i));
+    }
+    parser.Finish();
+    assertEq(std::to_string(streamed.size()), "2");
+    assertEq(streamed.size() == 2 ? streamed[1].name : "",
+             "Safe Credit Union - OFX Beta");
+    assertEq(streamed.size() == 2 ? streamed[0].profile["city"] : "",
+             "Valley Forge");
+  }
+
+  {
+    vector<Institution> insts = OfxDumpStringToInstitutions(kDump);
+    ofxget::ApplyInstitutionOverrides(R"(
+<institution id="479"><url>https://example.com/ofx</url>
+<profile bankmsgset="true"/></institution>
+<institution id="9999"><name>Local Bank</name><fid>42</fid></institution>
+)", &insts);
+    auto dir = InstitutionDirectory::FromInstitutions(insts);
+    auto vanguard = dir->view(*dir->FindById(479));
+    assertEq(string(vanguard.url()), "https://example.com/ofx");
+    assertEq(string(vanguard.fid()), "15103");
+    assertEq(string(vanguard.profile("bankmsgset")), "true");
+    assertEq(string(vanguard.profile("city")), "Valley Forge");
+    const DirRecord* added = dir->FindByFid("42");
+    assertEq(added ? string(dir->view(*added).name()) : "", "Local Bank");
+  }
+
+  {
+    vector<Institution> before = OfxDumpStringToInstitutions(kDump);
+    vector<Institution> after = before;
+    after[0].url = "https://example.com/ofx";
+    after.erase(after.begin() + 1);
+    after.push_back(before[0]);
+    after.back().ofxhome_id = 1000;
+    ofxget::InstitutionDelta delta = ofxget::DiffInstitutions(before, after);
+    assertEq(std::to_string(delta.added.size()) +
+             std::to_string(delta.removed.size()) +
+             std::to_string(delta.changed.size()), "111");
+    assertEq(delta.changed.empty() ? "" : std::to_string(delta.changed[0]),
+             "479");
+  }
+
+  const char* dir_file = "/tmp/ofxhome_test.dir";
+  WriteCompiledInstitutions(
+      CompileInstitutions(OfxDumpStringToInstitutions(kDump)), dir_file);
+  {
+    auto dir = InstitutionDirectory::FromImage(
+        DirectoryImage::MapFile(dir_file));
+    assertEq(std::to_string(dir->size()), "2");
+    const DirRecord* r = dir->FindById(479);
+    assertEq(r ? string(dir->str(r->brokerid)) : "", "vanguard.com");
+    assertEq(r ? std::to_string(r->profile_count) : "", "4");
+    assertEq(r ? string(dir->view(*r).profile("invstmtmsgset")) : "", "true");
+    assertEq(r ? string(dir->view(*r).profile("bankmsgset")) : "x", "");
+    assertEq(r ? std::to_string(dir->message_sets(*r)) : "",
+             std::to_string(ofxget::kSignonMsgSet |
+                            ofxget::kInvestmentMsgSet));
+    vector<const DirRecord*> investment;
+    dir->FindByMessageSets(ofxget::kInvestmentMsgSet, &investment);
+    assertEq(std::to_string(investment.size()), "1");
+    investment.clear();
+    dir->FindByMessageSets(ofxget::kBankMsgSet, &investment);
+    assertEq(std::to_string(investment.size()), "0");
+    r = dir->FindById(422);
+    assertEq(r ? string(dir->str(r->org)) : "", "DI");
+    assertEq(r ? std::to_string(r->ofxfail) : "", "3");
+    assertEq(dir->FindById(423) ? "found" : "", "");
+
+    // Readers holding a snapshot are unaffected by a swap.
+    InstitutionDirectory::Set(dir);
+    auto held = InstitutionDirectory::Get();
+    InstitutionDirectory::Set(InstitutionDirectory::FromInstitutions({}));
+    assertEq(std::to_string(held->size()), "2");
+    assertEq(std::to_string(InstitutionDirectory::Get()->size()), "0");
+
+    r = dir->FindByName("Vanguard");
+    Institution vanguard = dir->ToInstitution(*r);
+    assertEq(vanguard.url,
+             "https://vesnc.vanguard.com/us/OfxDirectConnectServlet");
+    assertEq(vanguard.profile["city"], "Valley Forge");
+
+    assertEq(std::to_string(dir->FindByFid("321173742")->ofxhome_id), "422");
+    assertEq(std::to_string(dir->FindByOrgFid("Vanguard", "15103")->ofxhome_id),
+             "479");
+    assertEq(dir->FindByOrgFid("DI", "15103") ? "found" : "", "");
+    assertEq(std::to_string(dir->FindByHost("VESNC.vanguard.com")->ofxhome_id),
+             "479");
+    // 479 passed validation in 2018, 422 could not be tested.
+    time_t now = 1600000000;  // 2020-09-13
+    double good = HealthScore(dir->view(*dir->FindById(479)), nullptr, now);
+    double bad = HealthScore(dir->view(*dir->FindById(422)), nullptr, now);
+    assertEq(good > 0.8 && bad < 0.7 ? "ok" : std::to_string(good) + " " +
+             std::to_string(bad), "ok");
+    // A server OFX Home recently failed to reach is skipped before we ever
+    // try it.
+    Institution broken = vanguard;
+    broken.ofxhome_id = 1;
+    broken.ofxfail = 1;
+    broken.lastofxvalidation = "2020-09-01 00:00:00";
+    auto broken_dir = InstitutionDirectory::FromInstitutions({broken});
+    double dead = HealthScore(broken_dir->view(*broken_dir->FindById(1)),
+                              nullptr, now);
+    assertEq(dead < DEFAULT_MIN_HEALTH ? "skip" : std::to_string(dead), "skip");
+    EndpointHistory history;
+    history.failures = history.consecutive_failures = 3;
+    history.last_failure = now - 3600;
+    double failing = HealthScore(dir->view(*dir->FindById(479)), &history, now);
+    assertEq(failing < DEFAULT_MIN_HEALTH ? "skip" : std::to_string(failing),
+             "skip");
+    history.last_failure = now - 30 * 86400;
+    double retry = HealthScore(dir->view(*dir->FindById(479)), &history, now);
+    assertEq(retry >= DEFAULT_MIN_HEALTH ? "retry" : std::to_string(retry),
+             "retry");
+
+    EndpointHealth health;
+    health.RecordFailure(479, now);
+    health.RecordFailure(479, now);
+    health.RecordSuccess(422, now);
+    health.Save("/tmp/ofxhome_test.health");
+    EndpointHealth loaded;
+    loaded.Load("/tmp/ofxhome_test.health");
+    remove("/tmp/ofxhome_test.health");
+    assertEq(loaded.Get(479, &history) ?
+             std::to_string(history.consecutive_failures) : "", "2");
+    assertEq(loaded.Get(422, &history) ?
+             std::to_string(history.successes) : "", "1");
+
+    auto matches = dir->Search("vangaurd", 5);
+    assertEq(matches.empty() ? "" : std::to_string(matches[0].record->ofxhome_id),
+             "479");
+    matches = dir->Search("SAFE credit-union", 5);
+    assertEq(matches.empty() ? "" : std::to_string(matches[0].record->ofxhome_id),
+             "422");
+    assertEq(std::to_string(dir->Search("zzzz", 5).size()), "0");
+    assertEq(string(InstitutionDirectory::UrlHost(
+                 "https://ofx.lanxtra.com:443/ofx/servlet/Teller")),
+             "ofx.lanxtra.com");
+  }
+  remove(dir_file);
+
+  // Concurrent writers each replace the file with a whole image.
+  {
+    const string images[] = {
+        CompileInstitutions(OfxDumpStringToInstitutions(kDump)),
+        CompileInstitutions({})};
+    vector<std::thread> writers;
+    for (const string& image : images) {
+      writers.emplace_back([&image, dir_file] {
+        for (int i = 0; i < 50; i++) WriteCompiledInstitutions(image, dir_file);
+      });
+    }
+    for (std::thread& writer : writers) writer.join();
+    string error;
+    try {
+      DirectoryImage::MapFile(dir_file);
+    } catch (const string& e) {
+      error = e;
+    }
+    assertEq(error, "");
+    remove(dir_file);
+  }
+
+  // Images with out of range strings or ids are rejected.
+  {
+    string image = CompileInstitutions(OfxDumpStringToInstitutions(kDump));
+    DirHeader header;
+    memcpy(&header, image.data(), sizeof(header));
+    std::size_t records = sizeof(DirHeader);
+    std::size_t profile = records + header.record_count * sizeof(DirRecord);
+    std::size_t strings =
+        profile + header.profile_count * sizeof(ofxget::DirProfileEntry);
+    const std::pair<std::size_t, uint32_t> corruptions[] = {
+      {records + offsetof(DirRecord, url), header.string_count},
+      {records + offsetof(DirRecord, profile_begin), header.profile_count + 1},
+      {profile + offsetof(ofxget::DirProfileEntry, value), 0xffffffff},
+      {strings + offsetof(ofxget::DirString, offset), header.pool_size + 1},
+      {strings + offsetof(ofxget::DirString, size), header.pool_size + 1},
+    };
+    for (const auto& corruption : corruptions) {
+      string corrupt = image;
+      memcpy(&corrupt[corruption.first], &corruption.second, sizeof(uint32_t));
+      string error;
+      try {
+        DirectoryImage::FromString(corrupt);
+      } catch (const string& e) {
+        error = e;
+      }
+      assertEq(error, "Incompatible institution directory: image. "
+                      "Rerun ofxhome -compile.");
+    }
+  }
+
+  // A compiled directory is only current for the files it was compiled from.
+  const char* base_file = "/tmp/ofxhome_test_institutions.txt";
+  const char* overrides_file = "/tmp/ofxhome_test_overrides.txt";
+  remove(overrides_file);
+  std::ofstream(base_file) << kDump;
+  {
+    auto image = DirectoryImage::FromString(
+        CompileInstitutionFiles(base_file, overrides_file));
+    assertEq(image->CompiledFrom(base_file, overrides_file) ? "current" : "",
+             "current");
+    assertEq(image->CompiledFrom("/tmp/other.txt", overrides_file) ? "x" : "",
+             "");
+    std::ofstream(overrides_file) << "<institution id=\"1\"/>";
+    assertEq(image->CompiledFrom(base_file, overrides_file) ? "x" : "", "");
+    remove(overrides_file);
+    assertEq(image->CompiledFrom(base_file, overrides_file) ? "current" : "",
+             "current");
+    std::ofstream(base_file, std::ios::app) << "\n";
+    assertEq(image->CompiledFrom(base_file, overrides_file) ? "x" : "", "");
+    assertEq(DirectoryImage::FromString(CompileInstitutions({}))
+                 ->CompiledFrom(base_file, overrides_file) ? "x" : "", "");
+  }
+  remove(base_file);
   return 0;
 }
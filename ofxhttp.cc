@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <cctype>
+#include <strings.h>
+
+#include "ofxhttp.h"
+
+namespace ofxget {
+
+static string ToLower(std::string_view s) {
+  string lower(s);
+  for (char& c : lower) c = tolower((unsigned char) c);
+  return lower;
+}
+
+string UrlOrigin(std::string_view url) {
+  std::size_t scheme_end = url.find("://");
+  if (scheme_end == std::string_view::npos || scheme_end == 0) return "";
+  string scheme = ToLower(url.substr(0, scheme_end));
+  std::string_view authority = url.substr(scheme_end + 3);
+  authority = authority.substr(0, authority.find_first_of("/?#"));
+  std::size_t at = authority.rfind('@');
+  if (at != std::string_view::npos) authority = authority.substr(at + 1);
+
+  // An IPv6 host is bracketed and contains colons.
+  std::size_t host_end = 0;
+  if (!authority.empty() && authority[0] == '[') {
+    host_end = authority.find(']');
+    if (host_end == std::string_view::npos) host_end = 0;
+  }
+  std::size_t colon = authority.find(':', host_end);
+  std::string_view host = authority.substr(0, colon);
+  std::string_view port;
+  if (colon != std::string_view::npos) port = authority.substr(colon + 1);
+  if (port.empty()) {
+    port = scheme == "https" ? "443" : scheme == "http" ? "80" : "";
+  }
+  return scheme + "://" + ToLower(host) + ":" + string(port);
+}
+
+long long ContentLength(std::string_view line) {
+  static const std::string_view kHeader = "Content-Length:";
+  if (line.size() <= kHeader.size() ||
+      strncasecmp(line.data(), kHeader.data(), kHeader.size()) != 0) {
+    return -1;
+  }
+  long long length = 0;
+  bool digits = false;
+  for (char c : line.substr(kHeader.size())) {
+    if (c >= '0' && c <= '9') {
+      if (length > MAX_RESPONSE_RESERVE) return -1;
+      length = length * 10 + (c - '0');
+      digits = true;
+    } else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+      return -1;
+    }
+  }
+  return digits ? length : -1;
+}
+
+size_t CurlReserveContentLength(char* buffer, size_t size, size_t nitems,
+                                void* userdata) {
+  long long length = ContentLength(std::string_view(buffer, size * nitems));
+  if (length > 0) {
+    string* out = static_cast<string*>(userdata);
+    out->reserve(out->size() +
+                 std::min<std::size_t>(length, MAX_RESPONSE_RESERVE));
+  }
+  return size * nitems;
+}
+
+CurlShare& CurlShare::Global() {
+  // Never destroyed, since pooled handles stay attached until exit.
+  static CurlShare* share = new CurlShare();
+  return *share;
+}
+
+CurlShare::CurlShare() {
+  share_ = curl_share_init();
+  if (!share_) {
+    throw string("Could not initialize curl share");
+  }
+  curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, Lock);
+  curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, Unlock);
+  curl_share_setopt(share_, CURLSHOPT_USERDATA, (void*) this);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+void CurlShare::Lock(CURL* curl, curl_lock_data data,
+                     curl_lock_access access, void* userptr) {
+  static_cast<CurlShare*>(userptr)->mutexes_[data].lock();
+}
+
+void CurlShare::Unlock(CURL* curl, curl_lock_data data, void* userptr) {
+  static_cast<CurlShare*>(userptr)->mutexes_[data].unlock();
+}
+
+CURL* NewCurlHandle() {
+  CURL* curl = curl_easy_init();
+  if (curl) CurlShare::Global().Attach(curl);
+  return curl;
+}
+
+CurlHandlePool& CurlHandlePool::Global() {
+  static CurlHandlePool pool;
+  return pool;
+}
+
+CURL* CurlHandlePool::Acquire(const string& url) {
+  string origin = UrlOrigin(url);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = idle_.find(origin);
+    if (it != idle_.end() && !it->second.empty()) {
+      CURL* curl = it->second.back();
+      it->second.pop_back();
+      // Reset keeps the share and the handle's open connections.
+      curl_easy_reset(curl);
+      return curl;
+    }
+  }
+  return NewCurlHandle();
+}
+
+void CurlHandlePool::Release(const string& url, CURL* curl) {
+  if (!curl) return;
+  string origin = UrlOrigin(url);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    vector<CURL*>& idle = idle_[origin];
+    if (idle.size() < MAX_IDLE_HANDLES_PER_ORIGIN) {
+      idle.push_back(curl);
+      return;
+    }
+  }
+  curl_easy_cleanup(curl);
+}
+
+void CurlHandlePool::RecordTransfer(CURL* curl) {
+  long connects = 0;
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.transfers++;
+  stats_.new_connections += connects;
+}
+
+ConnectionStats CurlHandlePool::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+std::size_t CurlHandlePool::idle_handles() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::size_t count = 0;
+  for (const auto& entry : idle_) count += entry.second.size();
+  return count;
+}
+
+void CurlHandlePool::Clear() {
+  map<string, vector<CURL*>> idle;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle.swap(idle_);
+  }
+  for (const auto& entry : idle) {
+    for (CURL* curl : entry.second) curl_easy_cleanup(curl);
+  }
+}
+
+ResponseBufferPool& ResponseBufferPool::Global() {
+  static ResponseBufferPool pool;
+  return pool;
+}
+
+string ResponseBufferPool::Take(std::size_t size) {
+  string buffer;
+  {
+    // The smallest buffer that fits, or else the largest one.
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t best = buffers_.size();
+    for (std::size_t i = 0; i < buffers_.size(); i++) {
+      if (best == buffers_.size()) {
+        best = i;
+        continue;
+      }
+      std::size_t capacity = buffers_[i].capacity();
+      std::size_t best_capacity = buffers_[best].capacity();
+      bool fits = capacity >= size;
+      bool best_fits = best_capacity >= size;
+      if (fits ? !best_fits || capacity < best_capacity
+               : !best_fits && capacity > best_capacity) {
+        best = i;
+      }
+    }
+    if (best < buffers_.size()) {
+      buffer.swap(buffers_[best]);
+      buffers_[best].swap(buffers_.back());
+      buffers_.pop_back();
+    }
+  }
+  buffer.clear();
+  buffer.reserve(std::min<std::size_t>(size, MAX_RESPONSE_RESERVE));
+  return buffer;
+}
+
+void ResponseBufferPool::Give(string buffer) {
+  if (buffer.capacity() < MIN_POOLED_BUFFER_SIZE ||
+      buffer.capacity() > MAX_POOLED_BUFFER_SIZE) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (buffers_.size() < MAX_POOLED_BUFFERS) {
+    buffers_.push_back(std::move(buffer));
+  }
+}
+
+std::size_t ResponseBufferPool::ExpectedSize(int id) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = sizes_.find(id);
+  return it == sizes_.end() ? 0 : it->second + it->second / 8;
+}
+
+void ResponseBufferPool::RecordSize(int id, std::size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sizes_[id] = size;
+}
+
+}  // namespace ofxget
@@ -0,0 +1,156 @@
+#ifndef OFXHTTP_H
+#define OFXHTTP_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <curl/curl.h>
+
+namespace ofxget {
+
+using std::map;
+using std::string;
+using std::vector;
+
+// Idle curl handles kept per origin. A batch run posts to one server at a
+// time, so a few are enough to keep its connections open between requests.
+#define MAX_IDLE_HANDLES_PER_ORIGIN 4
+
+// A response is reserved up front to at most this, whatever its
+// Content-Length claims.
+#define MAX_RESPONSE_RESERVE (64 << 20)
+
+// ResponseBufferPool keeps at most this many buffers, of
+// MIN_POOLED_BUFFER_SIZE to MAX_POOLED_BUFFER_SIZE bytes. Smaller ones are
+// not worth a slot.
+#define MAX_POOLED_BUFFERS 64
+#define MIN_POOLED_BUFFER_SIZE 4096
+#define MAX_POOLED_BUFFER_SIZE (16 << 20)
+
+// The lower case scheme, host and port of url, eg
+// "https://ofx.lanxtra.com:443". Connections can only be reused for the same
+// origin, so handles are pooled by it. Returns "" if url has no scheme.
+string UrlOrigin(std::string_view url);
+
+// Process wide curl share of the DNS cache and TLS sessions. Every handle
+// ofxget and ofxhome use is attached to it, so threads posting to the same FI
+// hosts resolve each host once and resume TLS sessions instead of full
+// handshakes. Thread safe; curl locks each shared cache with its own mutex.
+// Open connections are not shared, since libcurl does not support sharing
+// its connection cache between threads. They stay with each pooled handle,
+// or with the OfxMulti running the transfer.
+class CurlShare {
+ public:
+  static CurlShare& Global();
+
+  // Attach curl to the share. It stays attached across curl_easy_reset.
+  void Attach(CURL* curl) { curl_easy_setopt(curl, CURLOPT_SHARE, share_); }
+
+ private:
+  CurlShare();
+  static void Lock(CURL* curl, curl_lock_data data, curl_lock_access access,
+                   void* userptr);
+  static void Unlock(CURL* curl, curl_lock_data data, void* userptr);
+
+  CURLSH* share_;
+  std::mutex mutexes_[CURL_LOCK_DATA_LAST];
+};
+
+// A new easy handle attached to CurlShare::Global(), or null if curl can not
+// be initialized.
+CURL* NewCurlHandle();
+
+// Connection reuse over the transfers recorded by a CurlHandlePool.
+struct ConnectionStats {
+  uint64_t transfers = 0;
+  // Connections opened by those transfers, from CURLINFO_NUM_CONNECTS.
+  uint64_t new_connections = 0;
+
+  // Fraction of transfers that were sent on an already open connection.
+  double reuse_rate() const {
+    if (transfers == 0 || new_connections >= transfers) return 0;
+    return 1 - double(new_connections) / transfers;
+  }
+};
+
+// Thread safe pool of curl easy handles keyed by UrlOrigin. A curl handle
+// keeps its connections open and caches DNS and TLS sessions after a
+// transfer, so posting with a handle last used for the same server skips the
+// TCP and TLS handshakes. Institutions that share a hosting provider share
+// its handles. Global() is the pool PostRequest uses.
+class CurlHandlePool {
+ public:
+  static CurlHandlePool& Global();
+
+  CurlHandlePool() {}
+  CurlHandlePool(const CurlHandlePool&) = delete;
+  CurlHandlePool& operator=(const CurlHandlePool&) = delete;
+  ~CurlHandlePool() { Clear(); }
+
+  // A handle for a transfer to url attached to CurlShare::Global(): an idle
+  // one last used for its origin, with options reset but its connections
+  // kept, or else a new one.
+  // Returns null if curl can not be initialized.
+  CURL* Acquire(const string& url);
+
+  // Give back a handle from Acquire once its transfer is done. Handles over
+  // MAX_IDLE_HANDLES_PER_ORIGIN are cleaned up, closing their connections.
+  void Release(const string& url, CURL* curl);
+
+  // Count a completed transfer on curl in stats().
+  void RecordTransfer(CURL* curl);
+
+  ConnectionStats stats() const;
+  std::size_t idle_handles() const;
+
+  // Clean up every idle handle.
+  void Clear();
+
+ private:
+  mutable std::mutex mutex_;
+  map<string, vector<CURL*>> idle_;
+  ConnectionStats stats_;
+};
+
+// The value of line if it is a Content-Length header, otherwise -1.
+long long ContentLength(std::string_view line);
+
+// curl header callback that reserves the string* userdata for the body when
+// the response has a Content-Length.
+size_t CurlReserveContentLength(char* buffer, size_t size, size_t nitems,
+                                void* userdata);
+
+// Thread safe pool of response buffers, so that a run over many accounts
+// writes each response into the memory of an earlier one instead of growing a
+// new string by reallocation. It also remembers how large each
+// institution's last response was, to reserve for the next one when the
+// server sends no Content-Length.
+class ResponseBufferPool {
+ public:
+  static ResponseBufferPool& Global();
+
+  // An empty buffer with room for size bytes, recycled if one is pooled.
+  string Take(std::size_t size);
+
+  // Keep buffer for a later Take, unless the pool is full or the buffer's
+  // capacity is outside MIN_POOLED_BUFFER_SIZE to MAX_POOLED_BUFFER_SIZE.
+  void Give(string buffer);
+
+  // The size to reserve for the next response of id, eg an OFX Home id: the
+  // last one recorded with some room to grow, or 0 if none was.
+  std::size_t ExpectedSize(int id) const;
+  void RecordSize(int id, std::size_t size);
+
+ private:
+  mutable std::mutex mutex_;
+  vector<string> buffers_;
+  map<int, std::size_t> sizes_;
+};
+
+}  // namespace ofxget
+
+#endif // OFXHTTP_H
@@ -0,0 +1,132 @@
+#include <ctime>
+
+#include "ofxhealth.h"
+#include "ofxhttp.h"
+#include "ofxmulti.h"
+
+namespace ofxget {
+
+// Longest wait for socket activity before checking for timeouts again, in
+// milliseconds.
+#define MULTI_POLL_MS 1000
+
+OfxMulti::OfxMulti(int max_transfers, int max_per_origin)
+    : max_transfers_(max_transfers > 0 ? max_transfers : 1),
+      max_per_origin_(max_per_origin > 0 ? max_per_origin : 1) {
+  multi_ = curl_multi_init();
+  if (!multi_) {
+    throw string("Could not initialize curl");
+  }
+}
+
+OfxMulti::~OfxMulti() {
+  // Abandoned transfers are finished as failed so their handles go back to
+  // the pool, but their callbacks are not called.
+  for (auto& entry : running_) {
+    curl_multi_remove_handle(multi_, entry.first);
+    entry.second.context->FinishPost(entry.first, CURLE_ABORTED_BY_CALLBACK);
+  }
+  curl_multi_cleanup(multi_);
+}
+
+void OfxMulti::Add(OfxGetContext* context, Callback callback) {
+  const string* url = context->vars_map_.Find(kUrlVar);
+  string origin = url ? UrlOrigin(*url) : "";
+  double health = 1;
+  if (context->min_health_ > 0 && context->institution_id_ >= 0) {
+    try {
+      health = EndpointHealth::Global().Score(context->institution_id_,
+                                              time(nullptr));
+    } catch (const string&) {
+      // StartPost reports the error.
+    }
+  }
+  // Keep the queue healthiest first, and in the order added among equals.
+  std::deque<Request>& queue = origins_[origin].queue;
+  auto it = queue.end();
+  while (it != queue.begin() && (it - 1)->health < health) --it;
+  queue.insert(it, Request{context, std::move(callback), origin, health});
+  queued_++;
+}
+
+void OfxMulti::StartQueued(vector<Request>* failed) {
+  // Take the healthiest next request of the origins below their cap. Among
+  // equals, origins take turns, continuing after the origin served last.
+  // Repeat until the caps are reached or nothing can start.
+  while (queued_ > 0 && running_.size() < (std::size_t) max_transfers_) {
+    auto best = origins_.end();
+    auto it = origins_.upper_bound(last_origin_);
+    for (std::size_t i = 0; i < origins_.size(); i++, ++it) {
+      if (it == origins_.end()) it = origins_.begin();
+      const Origin& origin = it->second;
+      if (!origin.queue.empty() && origin.running < max_per_origin_ &&
+          (best == origins_.end() ||
+           origin.queue.front().health > best->second.queue.front().health)) {
+        best = it;
+      }
+    }
+    if (best == origins_.end()) break;
+    last_origin_ = best->first;
+    Origin& origin = best->second;
+    Request request = std::move(origin.queue.front());
+    origin.queue.pop_front();
+    queued_--;
+    CURL* curl = request.context->StartPost();
+    if (!curl) {
+      failed->push_back(std::move(request));
+    } else if (curl_multi_add_handle(multi_, curl) != CURLM_OK) {
+      request.context->FinishPost(curl, CURLE_FAILED_INIT);
+      failed->push_back(std::move(request));
+    } else {
+      origin.running++;
+      running_.emplace(curl, std::move(request));
+    }
+    if (origin.queue.empty() && origin.running == 0) {
+      origins_.erase(best);
+    }
+  }
+}
+
+int OfxMulti::FinishDone() {
+  int finished = 0;
+  CURLMsg* msg;
+  int left;
+  while ((msg = curl_multi_info_read(multi_, &left))) {
+    if (msg->msg != CURLMSG_DONE) continue;
+    CURL* curl = msg->easy_handle;
+    CURLcode result = msg->data.result;
+    curl_multi_remove_handle(multi_, curl);
+    auto it = running_.find(curl);
+    Request request = std::move(it->second);
+    running_.erase(it);
+    auto origin = origins_.find(request.origin);
+    if (--origin->second.running == 0 && origin->second.queue.empty()) {
+      origins_.erase(origin);
+    }
+    request.context->FinishPost(curl, result);
+    request.callback(*request.context);
+    finished++;
+  }
+  return finished;
+}
+
+void OfxMulti::Run() {
+  while (queued_ > 0 || !running_.empty()) {
+    vector<Request> failed;
+    StartQueued(&failed);
+    for (Request& request : failed) {
+      request.callback(*request.context);
+    }
+    if (running_.empty()) continue;
+
+    int still_running;
+    curl_multi_perform(multi_, &still_running);
+    // Wait for the network unless transfers finished and freed room for
+    // queued requests.
+    if (FinishDone() == 0) {
+      curl_multi_poll(multi_, nullptr, 0, MULTI_POLL_MS, nullptr);
+    }
+  }
+}
+
+}  // namespace ofxget
@@ -0,0 +1,95 @@
+#ifndef OFXMULTI_H
+#define OFXMULTI_H
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+
+#include <curl/curl.h>
+
+#include "ofxget.h"
+
+namespace ofxget {
+
+// Default caps on the transfers an OfxMulti runs at once. Many OFX servers
+// are small and throttle clients that open lots of connections, so the cap
+// per origin is low; a sweep gets its parallelism from the many servers.
+#define MULTI_MAX_TRANSFERS 64
+#define MULTI_MAX_TRANSFERS_PER_ORIGIN 4
+
+// OfxMulti posts the requests of many prepared OfxGetContexts concurrently
+// with curl_multi, so a sweep over many accounts takes about as long as the
+// slowest servers instead of the sum of every server's latency.
+//
+//   OfxMulti multi;
+//   for (OfxGetContext& account : accounts) {
+//     multi.Add(&account, [](OfxGetContext& done) {
+//       if (!done.is_error()) Save(done.response());
+//     });
+//   }
+//   multi.Run();
+//
+// Requests to the same origin (see UrlOrigin) start in the order added.
+// Origins take turns, so one large institution does not hold up the rest.
+// Requests with health checks (OfxGetContext::SkipUnhealthy) are
+// deprioritized by EndpointHealth score: the origin whose next request is
+// healthiest goes first, and within an origin healthier requests start
+// before others. Servers known to be broken then only take up transfers once
+// working ones have been served.
+class OfxMulti {
+ public:
+  // Called once per request when it completes, with the context's
+  // response() or error set as PostRequest would set them.
+  typedef std::function<void(OfxGetContext& context)> Callback;
+
+  OfxMulti(int max_transfers = MULTI_MAX_TRANSFERS,
+           int max_per_origin = MULTI_MAX_TRANSFERS_PER_ORIGIN);
+  ~OfxMulti();
+  OfxMulti(const OfxMulti&) = delete;
+  OfxMulti& operator=(const OfxMulti&) = delete;
+
+  // Queue the request of context, which must stay alive and unchanged until
+  // its callback is called. May be called from a callback.
+  void Add(OfxGetContext* context, Callback callback);
+
+  // Run transfers until every queued request, including any added by
+  // callbacks, has completed. Callbacks are called from Run on this thread.
+  void Run();
+
+  std::size_t queued() const { return queued_; }
+  std::size_t running() const { return running_.size(); }
+
+ private:
+  struct Request {
+    OfxGetContext* context;
+    Callback callback;
+    string origin;
+    // EndpointHealth score, or 1 without health checks.
+    double health;
+  };
+  struct Origin {
+    std::deque<Request> queue;
+    int running = 0;
+  };
+
+  // Start queued requests while the caps allow. Requests that fail before
+  // being sent are moved to failed.
+  void StartQueued(vector<Request>* failed);
+  // Finish the transfers curl reports done and call their callbacks. Returns
+  // how many finished.
+  int FinishDone();
+
+  CURLM* multi_;
+  int max_transfers_;
+  int max_per_origin_;
+  map<string, Origin> origins_;
+  // The origin StartQueued last took a request from.
+  string last_origin_;
+  std::size_t queued_ = 0;
+  map<CURL*, Request> running_;
+};
+
+}  // namespace ofxget
+
+#endif // OFXMULTI_H
@@ -0,0 +1,223 @@
+#include "ofxrequests.h"
+
+namespace ofxget {
+
+// The standard request templates, identical to the files under requests/ as
+// read by GetRequestTemplate, with each line ending in CRLF.
+
+// requests/accounts.txt
+constexpr std::string_view kAccountsText =
+    "OFXHEADER:100\r\n"
+    "DATA:OFXSGML\r\n"
+    "VERSION:102\r\n"
+    "SECURITY:NONE\r\n"
+    "ENCODING:USASCII\r\n"
+    "CHARSET:1252\r\n"
+    "COMPRESSION:NONE\r\n"
+    "OLDFILEUID:NONE\r\n"
+    "NEWFILEUID:$NEWFILEUID\r\n"
+    "\r\n"
+    "<OFX>\r\n"
+    "<SIGNONMSGSRQV1>\r\n"
+    "<SONRQ>\r\n"
+    "<DTCLIENT>$OFXDATE\r\n"
+    "<USERID>$USERID\r\n"
+    "<USERPASS>$USERPASS\r\n"
+    "<LANGUAGE>ENG\r\n"
+    "<FI>\r\n"
+    "<ORG>$ORG\r\n"
+    "<FID>$FID\r\n"
+    "</FI>\r\n"
+    "<APPID>$APPID\r\n"
+    "<APPVER>$APPVER\r\n"
+    "</SONRQ>\r\n"
+    "</SIGNONMSGSRQV1>\r\n"
+    "<SIGNUPMSGSRQV1>\r\n"
+    "<ACCTINFOTRNRQ>\r\n"
+    "<TRNUID>$TRNUID\r\n"
+    "<CLTCOOKIE>1\r\n"
+    "<ACCTINFORQ>\r\n"
+    "<DTACCTUP>19691231\r\n"
+    "</ACCTINFORQ>\r\n"
+    "</ACCTINFOTRNRQ>\r\n"
+    "</SIGNUPMSGSRQV1>\r\n"
+    "</OFX>\r\n"
+    "\r\n";
+static_assert(UsesKnownVars(kAccountsText), "accounts.txt uses an unknown variable");
+constexpr auto kAccountsSegments =
+    SplitSegments<CountSegments(kAccountsText)>(kAccountsText);
+
+// requests/bank.txt
+constexpr std::string_view kBankText =
+    "OFXHEADER:100\r\n"
+    "DATA:OFXSGML\r\n"
+    "VERSION:102\r\n"
+    "SECURITY:NONE\r\n"
+    "ENCODING:USASCII\r\n"
+    "CHARSET:1252\r\n"
+    "COMPRESSION:NONE\r\n"
+    "OLDFILEUID:NONE\r\n"
+    "NEWFILEUID:$NEWFILEUID\r\n"
+    "\r\n"
+    "<OFX>\r\n"
+    "<SIGNONMSGSRQV1>\r\n"
+    "<SONRQ>\r\n"
+    "<DTCLIENT>$OFXDATE\r\n"
+    "<USERID>$USERID\r\n"
+    "<USERPASS>$USERPASS\r\n"
+    "<LANGUAGE>ENG\r\n"
+    "<FI>\r\n"
+    "<ORG>$ORG\r\n"
+    "<FID>$FID\r\n"
+    "</FI>\r\n"
+    "<APPID>$APPID\r\n"
+    "<APPVER>$APPVER\r\n"
+    "</SONRQ>\r\n"
+    "</SIGNONMSGSRQV1>\r\n"
+    "<BANKMSGSRQV1>\r\n"
+    "<STMTTRNRQ>\r\n"
+    "<TRNUID>$TRNUID\r\n"
+    "<CLTCOOKIE>4\r\n"
+    "<STMTRQ>\r\n"
+    "<BANKACCTFROM>\r\n"
+    "<BANKID>$BANKID\r\n"
+    "<ACCTID>$ACCTID\r\n"
+    "<ACCTTYPE>SAVINGS\r\n"
+    "</BANKACCTFROM>\r\n"
+    "<INCTRAN>\r\n"
+    "<DTSTART>19000101\r\n"
+    "<INCLUDE>Y\r\n"
+    "</INCTRAN>\r\n"
+    "</STMTRQ>\r\n"
+    "</STMTTRNRQ>\r\n"
+    "</BANKMSGSRQV1>\r\n"
+    "</OFX>\r\n";
+static_assert(UsesKnownVars(kBankText), "bank.txt uses an unknown variable");
+constexpr auto kBankSegments =
+    SplitSegments<CountSegments(kBankText)>(kBankText);
+
+// requests/investment.txt
+constexpr std::string_view kInvestmentText =
+    "OFXHEADER:100\r\n"
+    "DATA:OFXSGML\r\n"
+    "VERSION:102\r\n"
+    "SECURITY:NONE\r\n"
+    "ENCODING:USASCII\r\n"
+    "CHARSET:1252\r\n"
+    "COMPRESSION:NONE\r\n"
+    "OLDFILEUID:NONE\r\n"
+    "NEWFILEUID:$NEWFILEUID\r\n"
+    "\r\n"
+    "<OFX>\r\n"
+    "<SIGNONMSGSRQV1>\r\n"
+    "<SONRQ>\r\n"
+    "<DTCLIENT>$OFXDATE\r\n"
+    "<USERID>$USERID\r\n"
+    "<USERPASS>$USERPASS\r\n"
+    "<LANGUAGE>ENG\r\n"
+    "<FI>\r\n"
+    "<ORG>$ORG\r\n"
+    "<FID>$FID\r\n"
+    "</FI>\r\n"
+    "<APPID>$APPID\r\n"
+    "<APPVER>$APPVER\r\n"
+    "</SONRQ>\r\n"
+    "</SIGNONMSGSRQV1>\r\n"
+    "<INVSTMTMSGSRQV1>\r\n"
+    "<INVSTMTTRNRQ>\r\n"
+    "<TRNUID>$TRNUID\r\n"
+    "<CLTCOOKIE>4\r\n"
+    "<INVSTMTRQ>\r\n"
+    "<INVACCTFROM>\r\n"
+    "<BROKERID>$BROKERID\r\n"
+    "<ACCTID>$ACCTID\r\n"
+    "</INVACCTFROM>\r\n"
+    "<INCTRAN>\r\n"
+    "<DTSTART>19000101\r\n"
+    "<INCLUDE>Y\r\n"
+    "</INCTRAN>\r\n"
+    "<INCOO>Y\r\n"
+    "<INCPOS>\r\n"
+    "<DTASOF>$OFXDATE\r\n"
+    "<INCLUDE>Y\r\n"
+    "</INCPOS>\r\n"
+    "<INCBAL>Y\r\n"
+    "</INVSTMTRQ>\r\n"
+    "</INVSTMTTRNRQ>\r\n"
+    "</INVSTMTMSGSRQV1>\r\n"
+    "</OFX>\r\n";
+static_assert(UsesKnownVars(kInvestmentText), "investment.txt uses an unknown variable");
+constexpr auto kInvestmentSegments =
+    SplitSegments<CountSegments(kInvestmentText)>(kInvestmentText);
+
+// requests/investment203.txt
+constexpr std::string_view kInvestment203Text =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\r\n"
+    "<?OFX OFXHEADER=\"200\" VERSION=\"203\" SECURITY=\"NONE\" "
+    "OLDFILEUID=\"NONE\"\r\n"
+    "NEWFILEUID=\"NONE\" ?>\r\n"
+    "\r\n"
+    "<OFX>\r\n"
+    "  <SIGNONMSGSRQV1>\r\n"
+    "    <SONRQ>\r\n"
+    "      <DTCLIENT>$OFXDATE</DTCLIENT>\r\n"
+    "      <USERID>$USERID</USERID>\r\n"
+    "      <USERPASS>$USERPASS</USERPASS>\r\n"
+    "      <LANGUAGE>ENG</LANGUAGE>\r\n"
+    "      <FI>\r\n"
+    "        <ORG>$ORG</ORG>\r\n"
+    "        <FID>$FID</FID>\r\n"
+    "      </FI>\r\n"
+    "      <APPID>$APPID</APPID>\r\n"
+    "      <APPVER>$APPVER</APPVER>\r\n"
+    "    </SONRQ>\r\n"
+    "  </SIGNONMSGSRQV1>\r\n"
+    "  <INVSTMTMSGSRQV1>\r\n"
+    "    <INVSTMTTRNRQ>\r\n"
+    "      <TRNUID>$TRNUID</TRNUID>\r\n"
+    "      <INVSTMTRQ>\r\n"
+    "        <INVACCTFROM>\r\n"
+    "          <BROKERID>$BROKERID</BROKERID>\r\n"
+    "          <ACCTID>$ACCTID</ACCTID>\r\n"
+    "        </INVACCTFROM>\r\n"
+    "        <INCTRAN>\r\n"
+    "          <INCLUDE>Y</INCLUDE>\r\n"
+    "        </INCTRAN>\r\n"
+    "        <INCOO>Y</INCOO>\r\n"
+    "        <INCPOS>\r\n"
+    "          <INCLUDE>Y</INCLUDE>\r\n"
+    "        </INCPOS>\r\n"
+    "        <INCBAL>Y</INCBAL>\r\n"
+    "      </INVSTMTRQ>\r\n"
+    "    </INVSTMTTRNRQ>\r\n"
+    "  </INVSTMTMSGSRQV1>\r\n"
+    "</OFX>\r\n";
+static_assert(UsesKnownVars(kInvestment203Text), "investment203.txt uses an unknown variable");
+constexpr auto kInvestment203Segments =
+    SplitSegments<CountSegments(kInvestment203Text)>(kInvestment203Text);
+
+struct BuiltinTemplate {
+  const char* name;
+  std::string_view text;
+  const TemplateSegment* segments;
+  std::size_t segment_count;
+};
+
+static constexpr BuiltinTemplate kBuiltinTemplates[] = {
+  {"accounts.txt", kAccountsText, kAccountsSegments.data(), kAccountsSegments.size()},
+  {"bank.txt", kBankText, kBankSegments.data(), kBankSegments.size()},
+  {"investment.txt", kInvestmentText, kInvestmentSegments.data(), kInvestmentSegments.size()},
+  {"investment203.txt", kInvestment203Text, kInvestment203Segments.data(), kInvestment203Segments.size()},
+};
+
+RequestTemplate BuiltinRequestTemplate(std::string_view name) {
+  for (const BuiltinTemplate& builtin : kBuiltinTemplates) {
+    if (name == builtin.name) {
+      return RequestTemplate(builtin.text, builtin.segments,
+                             builtin.segment_count);
+    }
+  }
+  return RequestTemplate();
+}
+
+}  // namespace ofxget
@@ -0,0 +1,19 @@
+#ifndef OFXREQUESTS_H
+#define OFXREQUESTS_H
+
+#include <string_view>
+
+#include "ofxtemplate.h"
+
+namespace ofxget {
+
+// The standard request templates (accounts.txt, bank.txt, investment.txt and
+// investment203.txt) are compiled into the binary, split into segments by the
+// compiler and checked to only use known OfxVars. Returns the template named
+// name, eg "investment.txt", without any file I/O or parsing, or an empty
+// template if there is no built-in template of that name.
+RequestTemplate BuiltinRequestTemplate(std::string_view name);
+
+}  // namespace ofxget
+
+#endif // OFXREQUESTS_H
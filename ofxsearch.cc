@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <utility>
+
+#include "ofxsearch.h"
+
+namespace ofxget {
+
+static inline char Normalize(char c) {
+  if (c >= 'A' && c <= 'Z') return c + ('a' - 'A');
+  if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) return c;
+  return ' ';
+}
+
+static inline uint32_t Trigram(char a, char b, char c) {
+  return ((uint32_t) (unsigned char) a << 16) |
+         ((uint32_t) (unsigned char) b << 8) | (unsigned char) c;
+}
+
+// Add the padded trigrams of word to out.
+static void WordTrigrams(const char* word, std::size_t size,
+                         vector<uint32_t>* out) {
+  // "  w", " wo", then every inner trigram, then "rd ".
+  char prev2 = ' ', prev1 = ' ';
+  for (std::size_t i = 0; i < size; i++) {
+    out->push_back(Trigram(prev2, prev1, word[i]));
+    prev2 = prev1;
+    prev1 = word[i];
+  }
+  out->push_back(Trigram(prev2, prev1, ' '));
+}
+
+void TrigramIndex::Trigrams(std::string_view text, vector<uint32_t>* out) {
+  std::size_t begin = out->size();
+  char word[256];
+  std::size_t size = 0;
+  char acronym[64];
+  std::size_t acronym_size = 0;
+  std::size_t words = 0;
+  for (std::size_t i = 0; i <= text.size(); i++) {
+    char c = i < text.size() ? Normalize(text[i]) : ' ';
+    if (c != ' ') {
+      if (size < sizeof(word)) word[size++] = c;
+      continue;
+    }
+    if (size == 0) continue;
+    WordTrigrams(word, size, out);
+    if (acronym_size < sizeof(acronym)) acronym[acronym_size++] = word[0];
+    words++;
+    size = 0;
+  }
+  if (words > 1) {
+    WordTrigrams(acronym, acronym_size, out);
+  }
+  std::sort(out->begin() + begin, out->end());
+  out->erase(std::unique(out->begin() + begin, out->end()), out->end());
+}
+
+void TrigramIndex::Build(const vector<std::string_view>& docs) {
+  vector<std::pair<uint32_t, uint32_t>> pairs;
+  vector<uint32_t> trigrams;
+  doc_trigrams_.resize(docs.size());
+  for (uint32_t d = 0; d < docs.size(); d++) {
+    trigrams.clear();
+    Trigrams(docs[d], &trigrams);
+    doc_trigrams_[d] = std::min<std::size_t>(trigrams.size(), 0xffff);
+    for (uint32_t t : trigrams) {
+      pairs.emplace_back(t, d);
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+
+  keys_.clear();
+  offsets_.clear();
+  postings_.clear();
+  postings_.reserve(pairs.size());
+  for (const auto& p : pairs) {
+    if (keys_.empty() || keys_.back() != p.first) {
+      keys_.push_back(p.first);
+      offsets_.push_back(postings_.size());
+    }
+    postings_.push_back(p.second);
+  }
+  offsets_.push_back(postings_.size());
+}
+
+vector<TrigramIndex::Match> TrigramIndex::Search(std::string_view query,
+                                                 std::size_t k) const {
+  vector<Match> matches;
+  vector<uint32_t> trigrams;
+  Trigrams(query, &trigrams);
+  if (trigrams.empty() || k == 0) return matches;
+
+  // Per thread scratch space so each keystroke does not allocate a counter
+  // per doc. Counters of touched docs are reset before returning.
+  thread_local vector<uint16_t> common;
+  thread_local vector<uint32_t> touched;
+  common.resize(doc_trigrams_.size());
+  touched.clear();
+  for (uint32_t t : trigrams) {
+    auto it = std::lower_bound(keys_.begin(), keys_.end(), t);
+    if (it == keys_.end() || *it != t) continue;
+    std::size_t key = it - keys_.begin();
+    for (uint32_t p = offsets_[key]; p < offsets_[key + 1]; p++) {
+      uint32_t doc = postings_[p];
+      if (common[doc]++ == 0) touched.push_back(doc);
+    }
+  }
+
+  // Rank mostly by how much of the query a doc covers, which suits prefixes
+  // typed into a search box, and break ties towards docs with fewer extra
+  // trigrams.
+  float q = trigrams.size();
+  for (uint32_t doc : touched) {
+    float c = common[doc];
+    float coverage = c / q;
+    float jaccard = c / (q + doc_trigrams_[doc] - c);
+    matches.push_back(Match{doc, 0.75f * coverage + 0.25f * jaccard});
+    common[doc] = 0;
+  }
+  auto better = [](const Match& a, const Match& b) {
+    return a.score != b.score ? a.score > b.score : a.doc < b.doc;
+  };
+  if (matches.size() > k) {
+    std::partial_sort(matches.begin(), matches.begin() + k, matches.end(),
+                      better);
+    matches.resize(k);
+  } else {
+    std::sort(matches.begin(), matches.end(), better);
+  }
+  return matches;
+}
+
+}  // namespace ofxget
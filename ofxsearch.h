@@ -0,0 +1,49 @@
+#ifndef OFXSEARCH_H
+#define OFXSEARCH_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace ofxget {
+
+// Trigram inverted index for ranked, typo tolerant name search. Text is
+// lowercased and everything except letters and digits is treated as a word
+// break, so "Vanguard Group, The" and "vanguard the group" index the same
+// words. Each word contributes its trigrams padded like "  w", " wo", "wor",
+// "ord", "rd ". Multi word names also index the acronym of their words so
+// that "chase cc" finds "Chase (credit card)".
+class TrigramIndex {
+ public:
+  struct Match {
+    uint32_t doc;
+    float score;
+  };
+
+  // Index docs. The doc number of docs[i] is i.
+  void Build(const vector<std::string_view>& docs);
+
+  // Return up to k docs sharing trigrams with query, best first. Scores are
+  // in (0, 1], 1 being every trigram of the query and the doc matching.
+  vector<Match> Search(std::string_view query, std::size_t k) const;
+
+  // Append the unique trigrams of text to out, sorted.
+  static void Trigrams(std::string_view text, vector<uint32_t>* out);
+
+ private:
+  // keys_ is sorted; the docs containing keys_[i] are
+  // postings_[offsets_[i], offsets_[i + 1]).
+  vector<uint32_t> keys_;
+  vector<uint32_t> offsets_;
+  vector<uint32_t> postings_;
+  // Number of unique trigrams in each doc.
+  vector<uint16_t> doc_trigrams_;
+};
+
+}  // namespace ofxget
+
+#endif // OFXSEARCH_H
@@ -0,0 +1,50 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "ofxhttp.h"
+#include "ofxsink.h"
+
+namespace ofxget {
+
+void StringSink::Begin(long long content_length) {
+  if (content_length > 0) {
+    out_->reserve(out_->size() + std::min<std::size_t>(content_length,
+                                                       MAX_RESPONSE_RESERVE));
+  }
+}
+
+FileSink::FileSink(const string& filename)
+    : filename_(filename), tmp_(filename + ".tmp") {
+  out_.open(tmp_.c_str(), std::ios::binary | std::ios::trunc);
+  if (!out_.is_open()) {
+    throw "Could not open " + tmp_;
+  }
+}
+
+FileSink::~FileSink() {
+  if (out_.is_open()) {
+    out_.close();
+    remove(tmp_.c_str());
+  }
+}
+
+bool FileSink::Write(const char* data, std::size_t size) {
+  out_.write(data, size);
+  return out_.good();
+}
+
+void FileSink::Finish(bool complete) {
+  if (!out_.is_open()) return;
+  out_.close();
+  if (!complete) {
+    remove(tmp_.c_str());
+  } else if (out_.fail()) {
+    remove(tmp_.c_str());
+    throw "Could not write " + tmp_;
+  } else if (rename(tmp_.c_str(), filename_.c_str()) != 0) {
+    remove(tmp_.c_str());
+    throw "Could not rename " + tmp_ + " to " + filename_;
+  }
+}
+
+}  // namespace ofxget
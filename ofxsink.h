@@ -0,0 +1,70 @@
+#ifndef OFXSINK_H
+#define OFXSINK_H
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+namespace ofxget {
+
+using std::string;
+
+// A ResponseSink consumes a response body chunk by chunk as curl receives
+// it, so parsing, hashing or writing to disk overlap with the transfer and a
+// large response is never held in memory whole. See
+// OfxGetContext::SetResponseSink.
+class ResponseSink {
+ public:
+  virtual ~ResponseSink() {}
+
+  // Called before the first chunk with the response's Content-Length, or -1
+  // if the server did not send one.
+  virtual void Begin(long long content_length) {}
+
+  // Consume the next chunk. Return false, or throw a string, to abort the
+  // transfer.
+  virtual bool Write(const char* data, std::size_t size) = 0;
+
+  // Called once the transfer is over, complete if it succeeded with an HTTP
+  // status below 400. Not called if the request failed before it was sent.
+  // Throws a string if the sink could not finish the response.
+  virtual void Finish(bool complete) {}
+};
+
+// Buffers the response in a string, reserved from the Content-Length. This
+// is what OfxGetContext uses for response() unless it is given another sink.
+class StringSink : public ResponseSink {
+ public:
+  explicit StringSink(string* out) : out_(out) {}
+
+  void Begin(long long content_length) override;
+  bool Write(const char* data, std::size_t size) override {
+    out_->append(data, size);
+    return true;
+  }
+
+ private:
+  string* out_;
+};
+
+// Writes the response to filename. It is written to filename + ".tmp" and
+// renamed when complete, so a failed download never leaves a partial file.
+class FileSink : public ResponseSink {
+ public:
+  // Throws a string if the file can not be created.
+  explicit FileSink(const string& filename);
+  ~FileSink();
+
+  bool Write(const char* data, std::size_t size) override;
+  // Throws a string if the file could not be written or renamed.
+  void Finish(bool complete) override;
+
+ private:
+  string filename_;
+  string tmp_;
+  std::ofstream out_;
+};
+
+}  // namespace ofxget
+
+#endif // OFXSINK_H
@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ofxtemplate.h"
+#include "ofxtime.h"
+
+namespace ofxget {
+
+RequestTemplate::RequestTemplate(string text) {
+  auto body = std::make_shared<Body>();
+  body->text = std::move(text);
+  SplitTemplate(body->text, [&](const TemplateSegment& segment) {
+    body->segments.push_back(segment);
+  });
+  text_ = body->text;
+  segments_ = body->segments.data();
+  segment_count_ = body->segments.size();
+  body_ = std::move(body);
+  Analyze();
+}
+
+RequestTemplate::RequestTemplate(std::string_view text,
+                                 const TemplateSegment* segments,
+                                 std::size_t segment_count)
+    : text_(text), segments_(segments), segment_count_(segment_count) {
+  Analyze();
+}
+
+void RequestTemplate::Analyze() {
+  vector<std::string_view> others;
+  for (const TemplateSegment& segment : *this) {
+    if (!segment.is_var) {
+      literal_size_ += segment.size;
+    } else if (segment.var >= 0) {
+      known_vars_ |= 1u << segment.var;
+    } else {
+      std::string_view name = segment_text(segment);
+      if (std::find(others.begin(), others.end(), name) == others.end()) {
+        others.push_back(name);
+      }
+    }
+  }
+  if (!others.empty()) {
+    other_vars_ =
+        std::make_shared<const vector<std::string_view>>(std::move(others));
+  }
+}
+
+const vector<std::string_view>& RequestTemplate::other_vars() const {
+  static const vector<std::string_view> kNone;
+  return other_vars_ ? *other_vars_ : kNone;
+}
+
+vector<string> RequestTemplate::MissingVars(const VarsMap& vars,
+                                            bool empty_is_missing) const {
+  vector<string> missing;
+  uint32_t known = MissingKnownVars(vars, empty_is_missing);
+  for (int var = 0; known; var++, known >>= 1) {
+    if (known & 1) missing.emplace_back(kOfxVarNames[var]);
+  }
+  for (std::string_view name : other_vars()) {
+    const string* value = vars.Find(name);
+    if (!value || (empty_is_missing && value->empty())) {
+      missing.emplace_back(name);
+    }
+  }
+  return missing;
+}
+
+bool RequestTemplate::RenderedSize(const VarsMap& vars, std::size_t* size,
+                                   string* missing) const {
+  *size = literal_size_;
+  for (const TemplateSegment& segment : *this) {
+    if (!segment.is_var) continue;
+    const string* v = value(vars, segment);
+    if (!v) {
+      *missing = string(segment_text(segment));
+      return false;
+    }
+    *size += v->size();
+  }
+  return true;
+}
+
+bool RequestTemplate::Render(const VarsMap& vars, string* out,
+                             string* missing) const {
+  out->clear();
+  // Size the request first so it is written without reallocating. Known
+  // variables are looked up by slot, so looking them up twice is cheap.
+  std::size_t size;
+  if (!RenderedSize(vars, &size, missing)) {
+    return false;
+  }
+  out->reserve(size);
+  for (const TemplateSegment& segment : *this) {
+    if (segment.is_var) {
+      out->append(*value(vars, segment));
+    } else {
+      out->append(text_.data() + segment.offset, segment.size);
+    }
+  }
+  return true;
+}
+
+std::size_t TemplateReader::Read(char* out, std::size_t size) {
+  std::size_t copied = 0;
+  while (copied < size && segment_ < template_.segment_count()) {
+    const TemplateSegment& segment = template_.begin()[segment_];
+    std::string_view text;
+    if (!segment.is_var) {
+      text = template_.segment_text(segment);
+    } else if (const string* value = template_.value(vars_, segment)) {
+      text = *value;
+    }
+    std::size_t n = std::min(size - copied, text.size() - offset_);
+    memcpy(out + copied, text.data() + offset_, n);
+    copied += n;
+    offset_ += n;
+    if (offset_ == text.size()) {
+      segment_++;
+      offset_ = 0;
+    }
+  }
+  return copied;
+}
+
+string NormalizeLineEndings(std::string_view text) {
+  string normalized;
+  normalized.reserve(text.size() +
+                     std::count(text.begin(), text.end(), '\n') + 2);
+  std::size_t begin = 0;
+  while (begin < text.size()) {
+    std::size_t end = text.find('\n', begin);
+    std::size_t next = end == std::string_view::npos ? text.size() : end + 1;
+    if (end == std::string_view::npos) end = text.size();
+    if (end > begin && text[end - 1] == '\r') end--;
+    normalized.append(text.data() + begin, end - begin);
+    normalized.append("\r\n");
+    begin = next;
+  }
+  return normalized;
+}
+
+static bool SameFile(const struct stat& st, dev_t device, ino_t inode,
+                     off_t size, const struct timespec& mtime) {
+  struct timespec modified = StatMtime(st);
+  return st.st_dev == device && st.st_ino == inode && st.st_size == size &&
+         modified.tv_sec == mtime.tv_sec && modified.tv_nsec == mtime.tv_nsec;
+}
+
+TemplateCache& TemplateCache::Global() {
+  static TemplateCache cache;
+  return cache;
+}
+
+RequestTemplate TemplateCache::Get(const string& filename) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) == 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(filename);
+    if (it != entries_.end() &&
+        SameFile(st, it->second.device, it->second.inode, it->second.size,
+                 it->second.mtime)) {
+      return it->second.request_template;
+    }
+  }
+
+  // Read the whole file with one read, using the stat of the open file so the
+  // entry describes what was read.
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) close(fd);
+    throw "Could not open " + filename;
+  }
+  string text(st.st_size, '\0');
+  std::size_t read_size = 0;
+  while (read_size < text.size()) {
+    ssize_t n = read(fd, &text[read_size], text.size() - read_size);
+    if (n <= 0) break;
+    read_size += n;
+  }
+  close(fd);
+  if (read_size != text.size()) {
+    throw "Could not read " + filename;
+  }
+
+  RequestTemplate request_template(NormalizeLineEndings(text));
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_[filename] = Entry{st.st_dev, st.st_ino, st.st_size,
+                             StatMtime(st), request_template};
+  return request_template;
+}
+
+void TemplateCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+}
+
+}  // namespace ofxget
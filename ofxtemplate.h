@@ -0,0 +1,216 @@
+#ifndef OFXTEMPLATE_H
+#define OFXTEMPLATE_H
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "ofxvars.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace ofxget {
+
+// A piece of a compiled request template, referring to the template text.
+// Literal segments are copied to the request as is. Variable segments hold the
+// name of a $VAR without the '$' and, if it is a known OfxVar, its slot.
+struct TemplateSegment {
+  uint32_t offset;
+  uint32_t size;
+  bool is_var;
+  // The OfxVar of a variable, or -1.
+  int8_t var;
+};
+
+// Call emit with each segment of text in order. A variable is a '$' followed
+// by upper case letters. This is constexpr so that built-in templates are
+// split by the compiler.
+template <typename Fn>
+constexpr void SplitTemplate(std::string_view text, Fn&& emit) {
+  // string_view::find is memchr at runtime.
+  std::size_t literal = 0;
+  for (std::size_t i = text.find('$'); i != std::string_view::npos;
+       i = text.find('$', literal)) {
+    std::size_t j = i + 1;
+    while (j < text.size() && text[j] >= 'A' && text[j] <= 'Z') j++;
+    if (i > literal) {
+      emit(TemplateSegment{uint32_t(literal), uint32_t(i - literal), false,
+                           -1});
+    }
+    emit(TemplateSegment{uint32_t(i + 1), uint32_t(j - i - 1), true,
+                         int8_t(OfxVarIndex(text.substr(i + 1, j - i - 1)))});
+    literal = j;
+  }
+  if (literal < text.size()) {
+    emit(TemplateSegment{uint32_t(literal), uint32_t(text.size() - literal),
+                         false, -1});
+  }
+}
+
+constexpr std::size_t CountSegments(std::string_view text) {
+  std::size_t count = 0;
+  SplitTemplate(text, [&count](const TemplateSegment&) { count++; });
+  return count;
+}
+
+// The segments of text, where N is CountSegments(text).
+template <std::size_t N>
+constexpr std::array<TemplateSegment, N> SplitSegments(std::string_view text) {
+  std::array<TemplateSegment, N> segments{};
+  std::size_t n = 0;
+  SplitTemplate(text, [&](const TemplateSegment& s) { segments[n++] = s; });
+  return segments;
+}
+
+// True if every variable in text is one of kOfxVarNames.
+constexpr bool UsesKnownVars(std::string_view text) {
+  bool known = true;
+  SplitTemplate(text, [&known](const TemplateSegment& s) {
+    if (s.is_var && s.var < 0) known = false;
+  });
+  return known;
+}
+
+// A request template split once into literal and variable segments.
+// Rendering sizes the request exactly and writes it in one linear pass, and
+// substituted values are never scanned for further variables, so a password
+// containing '$' is sent as typed. The variables a template uses are found
+// when it is compiled, so checking a VarsMap against it is a mask operation
+// for known variables. Copies share the compiled template.
+class RequestTemplate {
+ public:
+  RequestTemplate() {}
+  explicit RequestTemplate(string text);
+
+  // A template split at compile time. text and segments are not copied and
+  // must be static.
+  RequestTemplate(std::string_view text, const TemplateSegment* segments,
+                  std::size_t segment_count);
+
+  bool empty() const { return text_.empty(); }
+  std::string_view text() const { return text_; }
+  std::size_t segment_count() const { return segment_count_; }
+  const TemplateSegment* begin() const { return segments_; }
+  const TemplateSegment* end() const { return segments_ + segment_count_; }
+
+  // The literal text or variable name of a segment.
+  std::string_view segment_text(const TemplateSegment& segment) const {
+    return text_.substr(segment.offset, segment.size);
+  }
+
+  // The value of a variable segment in vars, or null if it is not set.
+  const string* value(const VarsMap& vars,
+                      const TemplateSegment& segment) const {
+    return segment.var >= 0 ? vars.Find(OfxVar(segment.var))
+                            : vars.Find(segment_text(segment));
+  }
+
+  // Bit 1 << var for each known OfxVar the template uses.
+  uint32_t known_vars() const { return known_vars_; }
+  // The unique variables that are not known OfxVars, in order of first use.
+  const vector<std::string_view>& other_vars() const;
+
+  // Bit 1 << var for each known OfxVar the template uses that vars does not
+  // set, or sets to "" if empty_is_missing.
+  uint32_t MissingKnownVars(const VarsMap& vars, bool empty_is_missing) const {
+    return known_vars_ & ~(empty_is_missing ? vars.known_nonempty()
+                                            : vars.known_set());
+  }
+
+  // The unique names of the variables MissingKnownVars reports, in OfxVar
+  // order, followed by other variables missing from vars.
+  vector<string> MissingVars(const VarsMap& vars, bool empty_is_missing) const;
+
+  // Set size to the size of the request. Returns false and sets missing to
+  // the name of the first variable not in vars.
+  bool RenderedSize(const VarsMap& vars, std::size_t* size,
+                    string* missing) const;
+
+  // Replace the contents of out with the request. out is allocated at most
+  // once. Returns false and sets missing to the name of the first variable
+  // not in vars.
+  bool Render(const VarsMap& vars, string* out, string* missing) const;
+
+ private:
+  struct Body {
+    string text;
+    vector<TemplateSegment> segments;
+  };
+  // Find the variables used and the size of the literal text.
+  void Analyze();
+
+  // Owns text_ and segments_ unless they are static.
+  std::shared_ptr<const Body> body_;
+  std::string_view text_;
+  const TemplateSegment* segments_ = nullptr;
+  std::size_t segment_count_ = 0;
+  uint32_t known_vars_ = 0;
+  std::size_t literal_size_ = 0;
+  // Null if every variable is a known OfxVar. Views into text_.
+  std::shared_ptr<const vector<std::string_view>> other_vars_;
+};
+
+// Streams the request a template renders to, segment by segment, without
+// materializing it, eg from a curl read callback. The template and vars must
+// not change while reading.
+class TemplateReader {
+ public:
+  TemplateReader(const RequestTemplate& request_template, const VarsMap& vars)
+      : template_(request_template), vars_(vars) {}
+
+  // Copy up to size bytes of the request to out and return how many were
+  // copied, 0 at the end. Variables not in vars read as empty.
+  std::size_t Read(char* out, std::size_t size);
+
+  // Start again from the beginning.
+  void Rewind() { segment_ = 0; offset_ = 0; }
+
+ private:
+  const RequestTemplate& template_;
+  const VarsMap& vars_;
+  // Position in the request: offset_ bytes into segment segment_.
+  std::size_t segment_ = 0;
+  std::size_t offset_ = 0;
+};
+
+// Return text with every line ending in CRLF, as OFX servers expect. Lines
+// may end in LF or CRLF, and a last line without one gets one.
+string NormalizeLineEndings(std::string_view text);
+
+// Process wide cache of compiled template files keyed by path, so long running
+// programs read each file once. A file is read again only when its inode,
+// size or modification time changes. Thread safe.
+class TemplateCache {
+ public:
+  static TemplateCache& Global();
+
+  // The template in filename with NormalizeLineEndings applied. Throws a
+  // string if the file can not be read.
+  RequestTemplate Get(const string& filename);
+
+  void Clear();
+
+ private:
+  struct Entry {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+    RequestTemplate request_template;
+  };
+  std::mutex mutex_;
+  map<string, Entry> entries_;
+};
+
+}  // namespace ofxget
+
+#endif // OFXTEMPLATE_H
@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "ofxtime.h"
+
+namespace ofxget {
+
+// The formatted minute of a thread, with zone suffix.
+struct OfxDateCache {
+  // Start of the cached minute, or -1.
+  time_t minute = -1;
+  char text[OFX_DATE_MAX_SIZE];
+  std::size_t size = 0;
+};
+
+// Format the minute containing t into cache.
+static void FormatMinute(time_t t, OfxDateCache* cache) {
+  struct tm ltime;
+  localtime_r(&t, &ltime);
+  // Every zone in use today is a whole number of minutes off GMT, so the
+  // local seconds are those of t.
+  cache->minute = t - ltime.tm_sec;
+  int size = snprintf(cache->text, sizeof(cache->text),
+                      "%04d%02d%02d%02d%02d%02d.000",
+                      1900 + ltime.tm_year, 1 + ltime.tm_mon, ltime.tm_mday,
+                      ltime.tm_hour, ltime.tm_min, ltime.tm_sec);
+  long offset = ltime.tm_gmtoff / 60;
+  long hours = offset / 60;
+  long minutes = offset < 0 ? -offset % 60 : offset % 60;
+  const char* sign = offset < 0 && hours == 0 ? "-" : "";
+  if (minutes == 0) {
+    size += snprintf(cache->text + size, sizeof(cache->text) - size,
+                     "[%s%ld:%s]", sign, hours, ltime.tm_zone);
+  } else {
+    // Fractions of an hour are written as decimals, eg 5.5 or 5.75.
+    char fraction[8];
+    snprintf(fraction, sizeof(fraction), "%02ld", minutes * 100 / 60);
+    if (fraction[1] == '0') fraction[1] = '\0';
+    size += snprintf(cache->text + size, sizeof(cache->text) - size,
+                     "[%s%ld.%s:%s]", sign, hours, fraction, ltime.tm_zone);
+  }
+  cache->size = std::min<std::size_t>(size, sizeof(cache->text));
+}
+
+std::size_t FormatOfxDate(time_t t, bool with_zone, char* out) {
+  thread_local OfxDateCache cache;
+  if (cache.minute < 0 || t < cache.minute || t >= cache.minute + 60) {
+    FormatMinute(t, &cache);
+  }
+  // Patch the seconds, "YYYYMMDDHHMM" is followed by "SS".
+  int seconds = t - cache.minute;
+  cache.text[12] = '0' + seconds / 10;
+  cache.text[13] = '0' + seconds % 10;
+  std::size_t size = with_zone ? cache.size : OFX_DATE_SIZE;
+  memcpy(out, cache.text, size);
+  return size;
+}
+
+std::string OfxDate(time_t t, bool with_zone) {
+  char text[OFX_DATE_MAX_SIZE];
+  return std::string(text, FormatOfxDate(t, with_zone, text));
+}
+
+}  // namespace ofxget
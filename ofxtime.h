@@ -0,0 +1,42 @@
+#ifndef OFXTIME_H
+#define OFXTIME_H
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+
+#include <sys/stat.h>
+
+namespace ofxget {
+
+// Size of an OFX date and time in local time, eg "20180421125958.000".
+#define OFX_DATE_SIZE 18
+// Upper bound on the size of a date with its time zone suffix, eg
+// "20180421125958.000[-5:EST]".
+#define OFX_DATE_MAX_SIZE 48
+
+// Write t as an OFX date in local time to out, which must have room for
+// OFX_DATE_MAX_SIZE characters, and return the size written. No NUL is
+// written. If with_zone, the GMT offset in hours and the zone name are
+// appended as FIs do, eg "[-5:EST]" or "[5.5:IST]".
+//
+// Safe to call from any thread. Each thread caches the last formatted
+// minute, so within it only the seconds digits are rewritten and localtime_r
+// is called once a minute.
+std::size_t FormatOfxDate(time_t t, bool with_zone, char* out);
+
+std::string OfxDate(time_t t, bool with_zone = false);
+
+// Modification time of a stat'ed file, with nanoseconds where the file
+// system has them. Linux calls the field st_mtim and macOS st_mtimespec.
+inline struct timespec StatMtime(const struct stat& st) {
+#ifdef __APPLE__
+  return st.st_mtimespec;
+#else
+  return st.st_mtim;
+#endif
+}
+
+}  // namespace ofxget
+
+#endif // OFXTIME_H
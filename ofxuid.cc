@@ -0,0 +1,64 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <unistd.h>
+
+#include "ofxuid.h"
+
+namespace ofxget {
+
+// Mix bits so that close inputs give unrelated outputs (splitmix64).
+static uint64_t Mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// Random bits identifying this process. random_device is combined with the
+// time and pid in case it is deterministic on this platform.
+static uint64_t ProcessPrefix() {
+  uint64_t seed = std::chrono::system_clock::now().time_since_epoch().count();
+  seed = Mix(seed ^ ((uint64_t) getpid() << 32));
+  try {
+    std::random_device random;
+    seed = Mix(seed ^ (((uint64_t) random() << 32) | random()));
+  } catch (...) {
+    // Time and pid alone still differ between runs.
+  }
+  return seed;
+}
+
+static std::atomic<uint64_t> g_uid_counter(0);
+
+static void WriteHex(uint64_t value, int digits, char* out) {
+  static const char kHex[] = "0123456789abcdef";
+  for (int i = digits - 1; i >= 0; i--) {
+    out[i] = kHex[value & 0xf];
+    value >>= 4;
+  }
+}
+
+void WriteOfxUid(char* out) {
+  static const uint64_t prefix = ProcessPrefix();
+  uint64_t counter = g_uid_counter.fetch_add(1, std::memory_order_relaxed);
+  // 8-4-4 hex digits of prefix, then 4-12 of counter.
+  WriteHex(prefix >> 32, 8, out);
+  out[8] = '-';
+  WriteHex(prefix >> 16, 4, out + 9);
+  out[13] = '-';
+  WriteHex(prefix, 4, out + 14);
+  out[18] = '-';
+  WriteHex(counter >> 48, 4, out + 19);
+  out[23] = '-';
+  WriteHex(counter, 12, out + 24);
+}
+
+std::string NewOfxUid() {
+  std::string uid(OFX_UID_SIZE, '\0');
+  WriteOfxUid(&uid[0]);
+  return uid;
+}
+
+}  // namespace ofxget
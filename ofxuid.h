@@ -0,0 +1,22 @@
+#ifndef OFXUID_H
+#define OFXUID_H
+
+#include <string>
+
+namespace ofxget {
+
+// Size of the UIDs used for TRNUID and NEWFILEUID, formatted like a UUID,
+// eg "3f2b8c1e-94d0-4a7b-0000-00000000002a". OFX allows up to 36 characters.
+#define OFX_UID_SIZE 36
+
+// Write a new UID to out, which must have room for OFX_UID_SIZE characters.
+// No NUL is written. UIDs are unique within the process, since the low half
+// is a counter, and across runs, since the high half is random per process.
+// Safe to call from many threads; it is a single atomic increment.
+void WriteOfxUid(char* out);
+
+std::string NewOfxUid();
+
+}  // namespace ofxget
+
+#endif // OFXUID_H
@@ -0,0 +1,51 @@
+#include "ofxvars.h"
+
+namespace ofxget {
+
+std::string& VarsMap::operator[](std::string_view name) {
+  int var = OfxVarIndex(name);
+  if (var >= 0) {
+    return (*this)[OfxVar(var)];
+  }
+  for (auto& spilled : spill_) {
+    if (spilled.first == name) return spilled.second;
+  }
+  spill_.emplace_back(std::string(name), std::string());
+  return spill_.back().second;
+}
+
+const std::string* VarsMap::Find(std::string_view name) const {
+  int var = OfxVarIndex(name);
+  if (var >= 0) {
+    return Find(OfxVar(var));
+  }
+  for (const auto& spilled : spill_) {
+    if (spilled.first == name) return &spilled.second;
+  }
+  return nullptr;
+}
+
+void VarsMap::Erase(std::string_view name) {
+  int var = OfxVarIndex(name);
+  if (var >= 0) {
+    set_ &= ~(1u << var);
+    slots_[var].clear();
+    return;
+  }
+  for (std::size_t i = 0; i < spill_.size(); i++) {
+    if (spill_[i].first == name) {
+      spill_.erase(spill_.begin() + i);
+      return;
+    }
+  }
+}
+
+void VarsMap::clear() {
+  for (int var = 0; var < kNumOfxVars; var++) {
+    slots_[var].clear();
+  }
+  set_ = 0;
+  spill_.clear();
+}
+
+}  // namespace ofxget
@@ -0,0 +1,99 @@
+#ifndef OFXVARS_H
+#define OFXVARS_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ofxget {
+
+// The variables OFX request templates are written against. Built-in
+// templates may only use these, which is checked at compile time.
+enum OfxVar {
+  kOfxDateVar,
+  kUserIdVar,
+  kUserPassVar,
+  kOrgVar,
+  kFidVar,
+  kAppIdVar,
+  kAppVerVar,
+  kBrokerIdVar,
+  kBankIdVar,
+  kAcctIdVar,
+  kUrlVar,
+  // Unique ids, see ofxuid.h. DTCLIENT and the like use OFXDATE.
+  kTrnUidVar,
+  kNewFileUidVar,
+  kNumOfxVars
+};
+
+constexpr std::string_view kOfxVarNames[kNumOfxVars] = {
+  "OFXDATE", "USERID", "USERPASS", "ORG", "FID", "APPID", "APPVER",
+  "BROKERID", "BANKID", "ACCTID", "URL", "TRNUID", "NEWFILEUID"};
+
+// The OfxVar named name, or -1 if it is not a known variable.
+constexpr int OfxVarIndex(std::string_view name) {
+  for (int i = 0; i < kNumOfxVars; i++) {
+    if (kOfxVarNames[i] == name) return i;
+  }
+  return -1;
+}
+
+// VarsMap is one half of the data used for building a request. The other is the
+// request template. VarsMap contains all of the variables that will be
+// substituted into the request. For example, VarMap["USERID"] = "myid".
+//
+// The known OfxVars are stored in fixed slots, so setting and reading them
+// costs an array index, and templates resolve their names to slots when they
+// are compiled. Other names spill to a small side table.
+class VarsMap {
+ public:
+  // The value of a variable, added empty if it is not set.
+  std::string& operator[](OfxVar var) {
+    set_ |= 1u << var;
+    return slots_[var];
+  }
+  std::string& operator[](std::string_view name);
+
+  // The value of a variable, or null if it is not set.
+  const std::string* Find(OfxVar var) const {
+    return (set_ >> var) & 1 ? &slots_[var] : nullptr;
+  }
+  const std::string* Find(std::string_view name) const;
+
+  // Bit 1 << var is set for each known variable that is set.
+  uint32_t known_set() const { return set_; }
+  // Bit 1 << var for each known variable that is set and not empty.
+  uint32_t known_nonempty() const {
+    uint32_t nonempty = 0;
+    for (int var = 0; var < kNumOfxVars; var++) {
+      if (!slots_[var].empty()) nonempty |= 1u << var;
+    }
+    return nonempty & set_;
+  }
+
+  void Erase(std::string_view name);
+  void clear();
+
+  // Call fn(name, value) for each set variable, known ones first.
+  template <typename Fn>
+  void ForEach(Fn fn) const {
+    for (int var = 0; var < kNumOfxVars; var++) {
+      if ((set_ >> var) & 1) fn(kOfxVarNames[var], slots_[var]);
+    }
+    for (const auto& spilled : spill_) {
+      fn(std::string_view(spilled.first), spilled.second);
+    }
+  }
+
+ private:
+  std::string slots_[kNumOfxVars];
+  uint32_t set_ = 0;
+  std::vector<std::pair<std::string, std::string>> spill_;
+};
+
+}  // namespace ofxget
+
+#endif // OFXVARS_H